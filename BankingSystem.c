@@ -4,42 +4,135 @@
  where many depositors and clients are able to process transactions to and from bank accounts concurrently.
  **/
 
+#define _GNU_SOURCE		//pthread_setaffinity_np and the CPU set macros
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <immintrin.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 //function prototypes(the first two are the thread start routines)
 void *makeDeposits(void *depositor);
 void *makeTransactions(void *client);
-void deposit(int accountNum, int amount, int transFeeType);
-void withdraw(int accountNum, int amount, int transFeeType);
-void transfer(int giveAccountNum, int takeAccountNum, int amount);
-
-//represents a bank account
-typedef struct account{		
-	int accountNum;		
-	char *type;		//either a Personal or Business bank account
+int deposit(int accountNum, int amount, int transFeeType);
+int depositAtomic(int accountNum, int amount, int transFeeType, int *balance, unsigned int *version);
+int withdraw(int accountNum, int amount, int transFeeType);
+int transfer(int giveAccountNum, int takeAccountNum, int amount);
+int transferReserve(int takeAccountNum, int amount);
+int transferCommit(int giveAccountNum, int amount);
+void transferRelease(int takeAccountNum, int amount);
+int overdraftCharge(int initialBalance, int newBalance, int overdraftFee, int *result);
+void lockAccounts(int accountNum1, int accountNum2);
+void unlockAccounts(int accountNum1, int accountNum2);
+void flushLocalCounters(void);
+void flushOptimisticCounts(void);
+
+//result of a transaction on an account
+enum transStatus{
+	TRANS_OK,		//the transaction was processed
+	TRANS_REJECTED		//the transaction was not processed, the account is unchanged
+};
+
+#define CACHE_LINE 64		//size of a cache line in bytes
+
+//account types, stored as a single byte in the account store
+enum accountType{
+	ACCOUNT_PERSONAL,
+	ACCOUNT_BUSINESS
+};
+
+//characteristics of a bank account as read from the input file, before they are moved into the account store
+typedef struct accountSpec{
+	unsigned char type;	//either a Personal or Business bank account
+	unsigned char overdraft;	//1 if overdraft exists on account and 0 if it does not
 	int depositFee;		
 	int withdrawFee;
 	int transferFee; 
 	int transactionNum;	//transaction number limit before additional fee is added to each transaction
 	int additionalFee;	//fee for when the trasnaction number is exceeded
 	int overdraftFee;	//fee for when overdraft is in effect
-	int overdraft;		//1 if overdraft exists on account and 0 if it does not
-	int balance;		//account balance
-	int numberOfAccTrans;	//number of transactions made on account
-} Acc;
+} AccSpec;
+
+//read-only fee configuration of every bank account, kept as a structure of arrays in one packed block
+typedef struct accountConfig{
+	int *depositFee;		
+	int *withdrawFee;
+	int *transferFee; 
+	int *transactionNum;		//transaction number limit before additional fee is added to each transaction
+	int *additionalFee;		//fee for when the trasnaction number is exceeded
+	int *overdraftFee;		//fee for when overdraft is in effect
+	unsigned char *overdraft;	//1 if overdraft exists on account and 0 if it does not
+	unsigned char *type;		//either ACCOUNT_PERSONAL or ACCOUNT_BUSINESS
+} AccConfig;
+
+//balance and number of transactions of an account packed into one 64-bit word for the lock-free deposit path
+typedef union accountBalance{
+	struct{
+		int balance;		//account balance
+		int numberOfAccTrans;	//number of transactions made on account
+	};
+	uint64_t balanceWord;
+} AccBalance;
+
+//waiter in the queue of a bank lock, one per thread since a thread waits for one lock at a time
+typedef struct mcsNode{
+	struct mcsNode *next;	//waiter queued behind this one
+	unsigned int state;	//MCS_READY once this waiter is at the head of the queue
+} __attribute__((aligned(CACHE_LINE))) McsNode;
+
+//lock used for the bank and for each account, either a pthread mutex or the spin-then-park lock selected with -m
+typedef union bankLock{
+	pthread_mutex_t mutex;
+	struct{
+		unsigned int word;	//0 free, 1 held, 2 held with threads parked on the futex
+		unsigned int contention;	//recent contention seen by the holders, the adaptive lock queues waiters while it is high
+		McsNode *tail;		//last waiter in the queue, NULL when no thread is queued
+	};
+} BankLock;
+
+int initBankLock(BankLock *bankLock);
+void destroyBankLock(BankLock *bankLock);
+void acquireBankLock(BankLock *bankLock);
+void releaseBankLock(BankLock *bankLock);
+
+//mutable state of a bank account, aligned and padded to its own cache line so that
+//threads working on neighbouring accounts never write to the same line
+typedef struct account{
+	union{
+		struct{
+			int balance;		//account balance
+			int numberOfAccTrans;	//number of transactions made on account
+		};
+		uint64_t balanceWord;	//balance and numberOfAccTrans packed together for the lock-free deposit path
+	};
+	BankLock accountLock;		//lock protecting this account when per-account locking is in use
+	int feeFreeTickets;		//transactionNum less the transactions counted, the additional fee applies at 0 or below, used with local counters
+	unsigned int journalVersion;	//last journal version given to a change of this account, orders its records on replay
+	unsigned int snapshotSequence;	//seqlock sequence for balance queries, odd while a writer is changing the account
+} __attribute__((aligned(CACHE_LINE))) Acc;
 
 //generic transaction made on an account
+//packed to 13 bytes since every parsed transaction is held in memory at once
 typedef struct transaction{
-	char transType;		//type of transaction occuring, d:deposit, w:withdraw, t:transfer
         int amount;		//amount associated with the transaction
         int takeAccountNum;	//account number relevant for a withdraw or part of a transfer(sender)
         int giveAccountNum;	//account number relevent for a deposit or part of a transfer(receiver)
-} Trans;
+	char transType;		//type of transaction occuring, d:deposit, w:withdraw, t:transfer
+} __attribute__((packed)) Trans;
 
 
 //client that can make transactions on accounts
@@ -56,377 +149,536 @@ typedef struct depositor{
 	Trans *transactions;	//pointer to a dynamically allocated array of transaction objects
 } Depo;
 
-Acc *accounts;			//pointer to an array of account objects which will be the accounts used in the bank
-pthread_mutex_t lock;		//global mutex lock used to mutually exclude in critical sections of program
+//overdraft tier configuration: an overdraft fee is charged for every tier of tierWidth the balance falls through
+typedef struct overdraftTiers{
+	int tierWidth;		//width of each overdraft tier
+	int limit;		//overdraft limit, a transaction that would have to cross this tier boundary is not processed
+} OverdraftTiers;
 
-int main(){
+#define IMAGE_MAGIC "BANKIMG"	//magic at the start of a compiled input image, followed by a zero byte
+#define IMAGE_VERSION 1		//version of the compiled image layout, bumped whenever any of the records below change
 
-	FILE *fp;							//input file pointer
-	FILE* output_fp;						//output file pointer
-	char* filename = "assignment_3_input_file.txt";			//name of input file
-	fp = fopen(filename, "r");
+//header of a compiled input image. The image holds the account table, the depositor and client lines and the packed
+//transactions as fixed-width records, each section starting on a cache line boundary at the offset given here
+typedef struct imageHeader{
+	char magic[8];			//IMAGE_MAGIC
+	uint32_t version;		//IMAGE_VERSION of the program that compiled the image
+	uint32_t accountCount;		//number of records in the account table
+	uint32_t depositorCount;	//number of depositor lines, stored before the client lines
+	uint32_t clientCount;		//number of client lines
+	uint64_t transCount;		//number of packed Trans records
+	uint64_t accountOffset;		//file offset of the account table
+	uint64_t lineOffset;		//file offset of the depositor and client lines
+	uint64_t transOffset;		//file offset of the transactions
+} ImageHeader;
 
-	if(fp == NULL){								//check to see if input file was unable to open			
-		printf("File %s could not be opened", filename);
-		fprintf(output_fp,"File %s could not be opened", filename);	//print to output file as well pointed at by output_fp
-		return 1;
-	}
+//characteristics of one account in a compiled image
+typedef struct imageAccount{
+	int32_t depositFee;
+	int32_t withdrawFee;
+	int32_t transferFee;
+	int32_t transactionNum;
+	int32_t additionalFee;
+	int32_t overdraftFee;
+	uint8_t type;			//ACCOUNT_PERSONAL or ACCOUNT_BUSINESS
+	uint8_t overdraft;		//1 if overdraft exists on account and 0 if it does not
+	uint8_t reserved[2];
+} ImageAccount;
 
-	output_fp = fopen("assignment_3_output_file.txt", "w");			//open output file with writing permissions on
+//depositor or client line in a compiled image: its slice of the transactions
+typedef struct imageLine{
+	uint64_t firstTrans;		//index of the line's first transaction
+	uint32_t numOfTrans;		//number of transactions on the line
+	uint32_t reserved;
+} ImageLine;
 
-	if(output_fp == NULL){							//check to see if output file was unable to open/create
-		printf("Output file could not be opened");
-		fprintf(output_fp,"Output file could not be opened");
-		return 1;
-	}
-	
-	int accountCount = 0;		//count the number of accounts 
-	int depositorCount = 0;		//count the number of depositors
-	int clientCount = 0;		//count the number of clients
-	char check;			//check character for input file extraction
-	
-	/*loop to determine the number of accounts, depositors and clients in input file*/	
-	while(1){			
-		check = fgetc(fp);
-		if (check == EOF){
-			break;
-		}
-		else if(check  == 'Y' || check == 'N'){		//looks for Y or N which each account has only once in input file
-			accountCount++;
-		}
-		else if(check == 'd'){				//looks for 'd' followed by an 'e' which denotes a depositor
-			check = fgetc(fp);
-			if(check == 'e'){
-				depositorCount++;
-			}
-		}
-		else if(check == 'c'){				//looks for a 'c' which denots a client
-			check = fgetc(fp);
-			if(check != 't'){
-				clientCount++;
-			}
-		}	
-	}
-	
-	fclose(fp);						//close input file
+//a sequence of transactions for the work-stealing scheduler: the remaining transactions of one depositor or client
+typedef struct task{
+	Trans *transactions;	//transactions of the depositor or client
+	int numOfTrans;		//number of transactions in the sequence
+	int next;		//index of the next transaction to run, only one worker holds the task at a time so program order is kept
+	int isDepositor;	//1 if the transactions belong to a depositor and 0 if they belong to a client
+} Task;
 
-	accounts = (Acc*)malloc(sizeof(Acc)*accountCount);			//dynamically allocated accounts array using the account count found above
-	Depo *depositors = malloc(sizeof(Depo)*depositorCount);			//dynamically allocated depositors array using the depositor count above
-	Cli *clients = malloc(sizeof(Cli)*clientCount);				//dynamically allocaed clients array using the client count found above
+//double ended queue of tasks owned by one worker; the owner works at the tail and other workers steal from the head
+typedef struct deque{
+	pthread_mutex_t dequeLock;	//lock protecting the deque from the owner and thieves
+	Task **tasks;			//dynamically allocated array of task pointers
+	int head;			//index of the oldest task, where thieves steal from
+	int tail;			//index one past the newest task, where the owner pushes and pops
+	int capacity;			//size of the tasks array
+} Deque;
 
-	fp = fopen(filename, "r");						//reopen input file
+void runDeposit(Trans *transaction);
+void runDepositBatch(Trans *transactions, int count);
+void runClientTransaction(Trans *transaction);
+int runOptimisticTransaction(Trans *transaction);
+void reportOptimisticCounts(void);
+int runTransfer(Trans *transaction);
+void transactionAccounts(Trans *transaction, int *accountNum1, int *accountNum2);
+int applyTransaction(Trans *transaction);
+void buildAccountStore(AccSpec *specs, int accountCount);
+void freeAccountStore(int accountCount);
+int loadInput(char *filename, int *accountCount, Depo **depositors, int *depositorCount, Cli **clients, int *clientCount, void (*lineParsed)(Task *line, int accountCount));
+int loadImage(char *imagename, int *accountCount, Depo **depositors, int *depositorCount, Cli **clients, int *clientCount, void (*lineParsed)(Task *line, int accountCount));
+int compileInput(char *filename, char *imagename);
+void pipelineLineParsed(Task *line, int accountCount);
+void finishPipeline(void);
+void runWorkStealing(Task *tasks, int taskCount);
+int poolSize(void);
+void pinThread(pthread_t thread, int index);
+long long nowNanoseconds(void);
+void recordLatency(long long start);
+void reportLatencies(long long elapsed);
+#ifdef LOCK_STATS
+void recordLockAcquired(int accountNum1, int accountNum2, long long waitStart);
+void recordLockReleased(void);
+void writeContentionReport(char *filename, int accountCount);
+#endif
+void runBatches(Task *tasks, int taskCount, int accountCount);
+void runShards(Task *tasks, int taskCount, int accountCount);
+int verifyBalances(char *goldenname, int accountCount);
+void writeBalances(int accountCount, FILE *output_fp);
+int startJournal(char *journalname);
+void journalOutcome(Trans *transaction, int status, int takeBalance, unsigned int takeVersion, int giveBalance, unsigned int giveVersion);
+void journalTransaction(Trans *transaction, int status);
+int stopJournal(int accountCount, Depo *depositors, int depositorCount, Cli *clients, int clientCount);
+int replayJournal(char *journalname, char *filename, char *imagename, FILE *output_fp);
+void readAccount(int accountNum, AccBalance *view);
+int loadCheckpoint(char *checkpointname, int accountCount, uint64_t *feedLines, uint64_t *feedTransactions);
+int runStream(char *streamname, char *checkpointname, int accountCount, uint64_t resumeLines, uint64_t resumeTransactions);
+int readBank(AccBalance *views, unsigned int *sequences, int accountCount);
+void startQueries(int accountCount);
+void stopQueries(void);
 
-        if(fp == NULL){
-                printf("File %s could not be opened", filename);
-                fprintf(output_fp,"File %s could not be opened", filename);     //print to output file as well pointed at by output_fp
-                return 1;
-        }
+//locking modes for the critical sections of the program
+enum lockMode{
+	LOCK_GLOBAL,		//every transaction takes the single global lock
+	LOCK_ACCOUNT,		//every transaction takes the locks of only the accounts it touches
+	LOCK_OPTIMISTIC		//client transactions run on private copies of their accounts and commit if no other thread changed them
+};
 
-	int value;
-	int i;
-	int j;
-	char c;
+Acc *accounts;			//pointer to an array of account objects which will be the accounts used in the bank
+Trans *transArena;		//arena holding the transactions of every depositor and client contiguously
+size_t transArenaSize;		//size in bytes of the memory reserved for the arena
+char *inputImage;		//mapping of the compiled image the transactions are run from, NULL when running the text input
+size_t inputImageSize;		//size in bytes of the compiled image mapping
+AccConfig accountConfig;	//fee configuration of the accounts, indexed the same way as accounts
+char *accountTypeNames[] = {"personal", "business"};	//names of the account types used in the output
+BankLock lock;			//global mutex lock used to mutually exclude in critical sections of program
+
+//engines that can run the depositor and client transactions
+enum engine{
+	ENGINE_THREAD,		//one thread per depositor and per client
+	ENGINE_STEAL,		//fixed pool of workers, one per core, balanced by work stealing
+	ENGINE_BATCH,		//lock-free batches of transactions that touch disjoint accounts, in a fixed order so results are deterministic
+	ENGINE_PIPELINE,	//workers run each depositor and client line while the rest of the file is still being parsed
+	ENGINE_SHARD		//one shard of accounts per core, transactions are passed to the shard owning their accounts
+};
+
+//primitives the bank and account locks can be built on
+enum lockPrimitive{
+	PRIMITIVE_MUTEX,	//pthread mutex
+	PRIMITIVE_SPIN,		//spin with exponential backoff, then park on a futex
+	PRIMITIVE_MCS,		//contended waiters queue up and spin on their own queue node before taking the lock
+	PRIMITIVE_ADAPTIVE	//spin then park, queueing waiters only while the lock stays contended
+};
+
+enum lockMode lockMode = LOCK_GLOBAL;	//locking mode selected on the command line
+enum lockPrimitive lockPrimitive = PRIMITIVE_MUTEX;	//lock primitive selected on the command line
+enum engine engine = ENGINE_THREAD;	//execution engine selected on the command line
+OverdraftTiers overdraftTiers = {500, 5000};	//tiers of 500 down to an overdraft limit of -5000
+int atomicDeposits = 0;		//1 if depositors use the lock-free deposit path on accounts without overdraft
+int depositKernel = 0;		//1 if each depositor's deposits are aggregated per account and applied by the vector kernel
+int localCounters = 0;		//1 if transaction counts are kept in per thread counters and merged at epoch boundaries
+int poolWorkers = 0;		//number of workers for the pooled engines, 0 means one per core
+int pinWorkers = 0;		//1 if every worker thread is pinned to a CPU, round robin over the CPUs the program may use
+int benchmark = 0;		//1 if transaction latencies are recorded and reported for the benchmark harness
+int journaling = 0;		//1 if every transaction is recorded in the journal
+int queryReaders = 0;		//number of query threads reading balances while the transactions run
+int echoBalances = 1;		//1 if the final balances are printed to stdout as well as the output file
+int reportPhases = 0;		//1 if the time spent in each phase of the run is printed to stderr
+long long checkpointEvery = 1000000;	//feed transactions between two checkpoints of a stream
 
-	/*loop through all accounts in input file and extract its characteristics*/
-	for(i = 0; i < accountCount; i++){	
-		Acc obj;
-		obj.accountNum = i+1;
-		obj.balance = 0;
-		obj.numberOfAccTrans = 0;
+//points in a run that are timed for the phase summary
+enum runPhase{PHASE_START, PHASE_PARSED, PHASE_DEPOSITORS, PHASE_CLIENTS, PHASE_OUTPUT, PHASE_COUNT};
 
-		while(fgetc(fp) != ' '){
-			fgetc(fp);
+//depositor or client lines shared by the threads of the thread engine when their number is set with -w
+typedef struct threadLines{
+	Depo *depositors;	//depositors to run, NULL when running clients
+	Cli *clients;		//clients to run, NULL when running depositors
+	int count;		//number of lines
+	int next;		//next line to hand out, taken atomically
+} ThreadLines;
+
+void *runThreadLines(void *lines);
+
+int main(int argc, char *argv[]){
+
+	int opt;
+	char *imagename = NULL;		//compiled image to run from instead of the text input
+	char *compilename = NULL;	//compiled image to write the text input to instead of running it
+	char *journalname = NULL;	//journal to record every transaction in
+	char *replayname = NULL;	//journal to rebuild the final balances from instead of running the input
+	char *goldenname = NULL;	//output of a deterministic run to check the final balances against
+	char *filename = "assignment_3_input_file.txt";		//name of input file
+	char *outputname = "assignment_3_output_file.txt";	//name of output file
+	char *streamname = NULL;	//feed of client lines run after the input file, "-" for stdin
+	char *checkpointname = NULL;	//checkpoint of the accounts written while streaming and resumed from at start
+
+	/*parse the command line options*/
+	while((opt = getopt(argc, argv, "l:ae:w:bcI:C:qj:R:Q:V:ki:o:ptm:S:K:E:")) != -1){
+		if(opt == 'l' && strcmp(optarg, "global") == 0){
+			lockMode = LOCK_GLOBAL;
 		}
-		
-		j = 0;
-		while(j<=4){
-			fgetc(fp);
-			j++;
+		else if(opt == 'l' && strcmp(optarg, "account") == 0){
+			lockMode = LOCK_ACCOUNT;
 		}
-		
-		if(fgetc(fp) == 'b'){		//account type
-			obj.type = "business";
+		else if(opt == 'l' && strcmp(optarg, "optimistic") == 0){
+			lockMode = LOCK_OPTIMISTIC;
+		}
+		else if(opt == 'a'){
+			atomicDeposits = 1;
+		}
+		else if(opt == 'e' && strcmp(optarg, "thread") == 0){
+			engine = ENGINE_THREAD;
+		}
+		else if(opt == 'e' && strcmp(optarg, "steal") == 0){
+			engine = ENGINE_STEAL;
+		}
+		else if(opt == 'e' && strcmp(optarg, "batch") == 0){
+			engine = ENGINE_BATCH;
+		}
+		else if(opt == 'e' && strcmp(optarg, "pipeline") == 0){
+			engine = ENGINE_PIPELINE;
+		}
+		else if(opt == 'e' && strcmp(optarg, "shard") == 0){
+			engine = ENGINE_SHARD;
+		}
+		else if(opt == 'w' && atoi(optarg) > 0){
+			poolWorkers = atoi(optarg);
+		}
+		else if(opt == 'b'){
+			benchmark = 1;
+		}
+		else if(opt == 'c'){
+			localCounters = 1;
+		}
+		else if(opt == 'I'){
+			imagename = optarg;
+		}
+		else if(opt == 'C'){
+			compilename = optarg;
+		}
+		else if(opt == 'q'){
+			echoBalances = 0;
+		}
+		else if(opt == 'j'){
+			journalname = optarg;
+		}
+		else if(opt == 'R'){
+			replayname = optarg;
+		}
+		else if(opt == 'Q' && atoi(optarg) > 0){
+			queryReaders = atoi(optarg);
+		}
+		else if(opt == 'V'){
+			goldenname = optarg;
+		}
+		else if(opt == 'k'){
+			depositKernel = 1;
+		}
+		else if(opt == 'i'){
+			filename = optarg;
+		}
+		else if(opt == 'o'){
+			outputname = optarg;
+		}
+		else if(opt == 'p'){
+			pinWorkers = 1;
+		}
+		else if(opt == 't'){
+			reportPhases = 1;
+		}
+		else if(opt == 'm' && strcmp(optarg, "mutex") == 0){
+			lockPrimitive = PRIMITIVE_MUTEX;
+		}
+		else if(opt == 'm' && strcmp(optarg, "spin") == 0){
+			lockPrimitive = PRIMITIVE_SPIN;
+		}
+		else if(opt == 'm' && strcmp(optarg, "mcs") == 0){
+			lockPrimitive = PRIMITIVE_MCS;
+		}
+		else if(opt == 'm' && strcmp(optarg, "adaptive") == 0){
+			lockPrimitive = PRIMITIVE_ADAPTIVE;
+		}
+		else if(opt == 'S'){
+			streamname = optarg;
+		}
+		else if(opt == 'K'){
+			checkpointname = optarg;
+		}
+		else if(opt == 'E' && atoll(optarg) > 0){
+			checkpointEvery = atoll(optarg);
 		}
-
 		else{
-			obj.type = "personal";
+			fprintf(stderr, "usage: %s [-l global|account|optimistic] [-a] [-e thread|steal|batch|pipeline|shard] [-w workers] [-b] [-c] "
+				"[-I image | -C image] [-q] [-j journal | -R journal] [-Q readers] [-V golden] [-k] [-i input] [-o output] [-p] [-t] "
+				"[-m mutex|spin|mcs|adaptive] [-S feed [-K checkpoint] [-E transactions]]\n", argv[0]);
+			return 1;
 		}
-		
-		j = 0;
-                while(j<10){
-                        fgetc(fp);
-                        j++;
-                }
-		
-		fscanf(fp, "%d", &value);	//extract deposit fee
-		obj.depositFee = value;
-		
-		fgetc(fp);
-		fgetc(fp);
-		fgetc(fp);
-
-                fscanf(fp, "%d", &value);	//extract withdraw fee
-		obj.withdrawFee = value;
-		
-		fgetc(fp);
-		fgetc(fp);
-		fgetc(fp);
-
-                fscanf(fp, "%d", &value);	//extract transfer fee
-		obj.transferFee = value;
-					
-		j = 0;
-                while(j<14){
-                        fgetc(fp);
-                        j++;
-                }
-
-		fscanf(fp, "%d", &value);
-		obj.transactionNum = value;	//extract the additionalFee limit
-		
-		fgetc(fp);
-
-		fscanf(fp, "%d", &value);
-		obj.additionalFee = value;	//extract the additional fee
+	}
 
-		j = 0;
-                while(j<11){
-                        fgetc(fp);
-                        j++;
-                }
+	FILE* output_fp;						//output file pointer
 
-		fscanf(fp, "%c", &c);
+	if(compilename != NULL){						//compile mode only writes the image, no transactions are run
+		return compileInput(filename, compilename);
+	}
 
-		if(c == 'N'){
-			obj.overdraft = 0;
+	if(journalname != NULL && engine == ENGINE_SHARD){			//no shard holds both accounts of a transfer to journal it
+		fprintf(stderr, "The shard engine cannot record a journal\n");
+		return 1;
+	}
 
-			accounts[i] = obj;
-			fgetc(fp);
-			continue;			//if there is no overdraft associated with account move onto the next account
-		}
-		else{					//extract the overdraft characteristic, the overdraft fee
-			fgetc(fp);
-			fscanf(fp, "%d", &value);
-			obj.overdraft = 1;
-			obj.overdraftFee = value;
-			accounts[i] = obj;
-			fgetc(fp);
-		}	
+	if(streamname != NULL && (journalname != NULL || benchmark)){		//both keep something for every transaction
+		fprintf(stderr, "A stream cannot be journaled or benchmarked\n");
+		return 1;
 	}
-	
-	int transactionCount = 0;		//keeps track of the number of transactions the depositors or clients have
 
-	/*for each depositor create a dynamic array of transactions after counting how many*/
-	for(i = 0; i < depositorCount; i++){	
-		transactionCount = 0;
-		fgetc(fp);		//skip over first d for depositor
-		while(1){		//loop until new line character while counting the number of transactions in the depositor line
-			check = fgetc(fp);
+	if(localCounters && lockMode == LOCK_OPTIMISTIC){			//fee free tickets are taken before a transaction can commit
+		fprintf(stderr, "Local counters cannot be used with optimistic transactions\n");
+		return 1;
+	}
 
-			if(check == 'd' || check == 'w' || check == 't'){
-				transactionCount++;
-			}
+	output_fp = fopen(outputname, "w");					//open output file with writing permissions on
 
-			if(check == '\n'){
-				break;
-			}
-		}
+	if(output_fp == NULL){							//check to see if output file was unable to open/create
+		printf("Output file %s could not be opened", outputname);
+		return 1;
+	}
 
-		Depo obj;
-		Trans *depTransactions= malloc(sizeof(Trans)*transactionCount);		//dynamically allocated transaction array to store depositor transactions
-		obj.depositorNum = i+1;
-		obj.transactions = depTransactions;
-		obj.numOfTrans = transactionCount;
-		depositors[i] = obj;
+	if(replayname != NULL){							//replay mode rebuilds the balances without running anything
+		int replayFailed = replayJournal(replayname, filename, imagename, output_fp);
+		fclose(output_fp);
+		return replayFailed;
 	}
 	
-	/*for each client create a dynamic array of transactions after counting how many*/
-	for(i = 0; i < clientCount; i++){
-		transactionCount = 0;
-		while(1){
-			check = fgetc(fp);
+	int accountCount = 0;		//count the number of accounts 
+	int depositorCount = 0;		//count the number of depositors
+	int clientCount = 0;		//count the number of clients
+	Depo *depositors;		//dynamically allocated depositors array filled in by the loader
+	Cli *clients;			//dynamically allocated clients array filled in by the loader
+	int i;
 
-			if(check == 'd' || check == 'w' || check == 't'){
-                                transactionCount++;
-                        }
+	//mutex lock validation
+	if (initBankLock(&lock) != 0)
+    	{
+        	printf("\n mutex init failed\n");
+        	return 1;
+   	} 
 
-                        if(check == '\n' || check == EOF){
-                                break;
-                        }
-		}
-		
-		Cli obj;
-		Trans *cliTransactions = malloc(sizeof(Trans)*transactionCount);	//dynamically allocated client array to store client transactions
-		obj.clientNum = i+1;
-		obj.transactions = cliTransactions;
-		obj.numOfTrans = transactionCount;
-		clients[i] = obj;
+	if(journalname != NULL && startJournal(journalname) != 0){		//the journal has to be recording before the pipeline engine starts
+		return 1;
 	}
 
-	fclose(fp);			//close input file
-	
-	fp = fopen(filename, "r");	//reopen input file for a third time
+	//a checkpoint already holds the effect of the input's depositor and client lines, so they are not run again
+	int resuming = streamname != NULL && checkpointname != NULL && access(checkpointname, F_OK) == 0;
+	uint64_t resumeLines = 0;		//feed lines the checkpoint already holds
+	uint64_t resumeTransactions = 0;	//transactions on those lines
 
-        if(fp == NULL){
-                printf("File %s could not be opened", filename);
-                fprintf(output_fp,"File %s could not be opened", filename);     //print to output file as well pointed at by output_fp
-                return 1;
-        }
-	
-	i = 0;
+	long long phaseMarks[PHASE_COUNT];		//when each phase of the run ended
+	long long runStart = nowNanoseconds();
+	phaseMarks[PHASE_START] = runStart;
 
-	//move the input file pointer to point at the first depositor line in the input file
-	while(i < accountCount){
-		check = fgetc(fp);
-		if(check == '\n'){
-			i++;
-		}
+	/*load the accounts, depositors and clients from the input file in a single pass; the pipeline engine
+	 * runs each depositor and client line as soon as it is parsed*/
+	int loadFailed;
+	void (*lineParsed)(Task *line, int accountCount) = engine == ENGINE_PIPELINE && !resuming ? &pipelineLineParsed : NULL;
+	if(imagename != NULL){
+		loadFailed = loadImage(imagename, &accountCount, &depositors, &depositorCount, &clients, &clientCount, lineParsed);
 	}
-	
-	/*extract depositor charactersitics from input file*/
-	for(i = 0; i < depositorCount; i++){
-                fgetc(fp);              //skip over first d for dep
-		j = 0;
-                while(1){
-                        check = fgetc(fp);
-
-                        if(check == 'd'){
-				depositors[i].transactions[j].transType = 'd';
-				fgetc(fp);
-				fgetc(fp);
-				fscanf(fp, "%d", &value);
-				depositors[i].transactions[j].giveAccountNum = value;
-				fgetc(fp);
-				fscanf(fp, "%d", &value);
-				depositors[i].transactions[j].amount = value;
-				j++;
-                        }
-
-                        if(check == '\n'){
-                                break;
-                        }
-                }
+	else{
+		loadFailed = loadInput(filename, &accountCount, &depositors, &depositorCount, &clients, &clientCount, lineParsed);
 	}
-	
-	/*extract client charactersitics from the input file*/
-	for(i = 0; i < clientCount; i++){		
-		j = 0;
-                while(1){
-                        check = fgetc(fp);
-
-                        if(check == 'd'){						//if the transaction is a deposit
-                                clients[i].transactions[j].transType = 'd';
-                                fgetc(fp);
-                                fgetc(fp);
-                                fscanf(fp, "%d", &value);
-                                clients[i].transactions[j].giveAccountNum = value;
-                                fgetc(fp);
-                                fscanf(fp, "%d", &value);
-                                clients[i].transactions[j].amount = value;
-                                j++;
-                        }
-
-                        else if(check == 'w'){						//if the transaction is a withdraw
-                                clients[i].transactions[j].transType = 'w';
-                                fgetc(fp);
-                                fgetc(fp);
-                                fscanf(fp, "%d", &value);
-                                clients[i].transactions[j].takeAccountNum = value;
-                                fgetc(fp);
-                                fscanf(fp, "%d", &value);
-                                clients[i].transactions[j].amount = value;
-                                j++;
-                        }
-
-                        else if(check == 't'){						//if the transaction is a transfer
-                                clients[i].transactions[j].transType = 't';
-                                fgetc(fp);
-                                fgetc(fp);
-                                fscanf(fp, "%d", &value);
-                                clients[i].transactions[j].takeAccountNum = value;
-                                fgetc(fp);
-                                fgetc(fp);
-                                fscanf(fp, "%d", &value);
-                                clients[i].transactions[j].giveAccountNum = value;
-                                fgetc(fp);
-                                fscanf(fp, "%d", &value);
-                                clients[i].transactions[j].amount = value;
-                                j++;
-                        }
-
-                        if(check == '\n' || check == EOF){
-                                break;	//break out of loop if the end of file is reached
-                        }
-                }
+	if(loadFailed){
+		fprintf(output_fp,"File %s could not be opened", imagename != NULL ? imagename : filename);	//print to output file as well pointed at by output_fp
+		return 1;
 	}
-	
-	fclose(fp);			//close input file
+	phaseMarks[PHASE_PARSED] = nowNanoseconds();	//the pipeline engine has run the lines parsed so far as well
 
 	//create the threading functions and their calls
 	int err_thread;
 	
 	pthread_t *threads = malloc(sizeof(pthread_t)*depositorCount);	//dynamic array of threads for the number of depositors 
 	pthread_t *threads1 = malloc(sizeof(pthread_t)*clientCount);	//dynamic array of threads for the number of clients
-	
-	//mutex lock validation
-	if (pthread_mutex_init(&lock, NULL) != 0)
-    	{
-        	printf("\n mutex init failed\n");
-        	return 1;
-   	} 
 
-	/*create threads for each depositor using the thread routine makeDeposites*/
-	for(i = 0; i < depositorCount; i++){
-		err_thread = pthread_create(&threads[i], NULL, &makeDeposits, &depositors[i]);	
-		if(err_thread != 0){	//check if thread is created successfully
-			printf("\n Error creating thread %d", i);
+	if(engine != ENGINE_PIPELINE){
+		runStart = nowNanoseconds();	//only the pipeline engine overlaps parsing with running transactions
+	}
+
+	if(queryReaders){
+		startQueries(accountCount);	//the readers run for as long as the transactions do
+	}
+
+	if(resuming){
+		if(loadCheckpoint(checkpointname, accountCount, &resumeLines, &resumeTransactions) != 0){
+			return 1;
+		}
+		phaseMarks[PHASE_DEPOSITORS] = nowNanoseconds();
+	}
+	else if(engine == ENGINE_PIPELINE){
+		phaseMarks[PHASE_DEPOSITORS] = phaseMarks[PHASE_PARSED];	//depositors and clients are not run apart
+		finishPipeline();		//wait for the workers to run the lines still queued
+	}
+	else if(engine == ENGINE_STEAL || engine == ENGINE_BATCH || engine == ENGINE_SHARD){
+		Task *tasks = malloc(sizeof(Task)*(depositorCount + clientCount));	//one task per depositor and per client
+
+		for(i = 0; i < depositorCount; i++){
+			tasks[i].transactions = depositors[i].transactions;
+			tasks[i].numOfTrans = depositors[i].numOfTrans;
+			tasks[i].next = 0;
+			tasks[i].isDepositor = 1;
+		}
+		for(i = 0; i < clientCount; i++){
+			tasks[depositorCount + i].transactions = clients[i].transactions;
+			tasks[depositorCount + i].numOfTrans = clients[i].numOfTrans;
+			tasks[depositorCount + i].next = 0;
+			tasks[depositorCount + i].isDepositor = 0;
+		}
+
+		if(engine == ENGINE_STEAL){
+			runWorkStealing(tasks, depositorCount);				//depositors are done before client tasks begin
+			phaseMarks[PHASE_DEPOSITORS] = nowNanoseconds();
+			runWorkStealing(tasks + depositorCount, clientCount);
+		}
+		else if(engine == ENGINE_BATCH){
+			runBatches(tasks, depositorCount, accountCount);
+			phaseMarks[PHASE_DEPOSITORS] = nowNanoseconds();
+			runBatches(tasks + depositorCount, clientCount, accountCount);
+		}
+		else{
+			runShards(tasks, depositorCount, accountCount);
+			phaseMarks[PHASE_DEPOSITORS] = nowNanoseconds();
+			runShards(tasks + depositorCount, clientCount, accountCount);
+		}
+		free(tasks);
+	}
+	else if(poolWorkers > 0){
+		/*a fixed number of threads share the lines, each taking the next depositor or client when it is done with one*/
+		ThreadLines lines = {depositors, NULL, depositorCount, 0};
+		int threadCount = poolWorkers < depositorCount ? poolWorkers : depositorCount;
+
+		for(i = 0; i < threadCount; i++){
+			err_thread = pthread_create(&threads[i], NULL, &runThreadLines, &lines);
+			if(err_thread != 0){	//check if thread is created successfully
+				printf("\n Error creating thread %d", i);
+			}
+			pinThread(threads[i], i);
+		}
+		for(i = 0; i < threadCount; i++)
+			pthread_join(threads[i], NULL);
+		phaseMarks[PHASE_DEPOSITORS] = nowNanoseconds();
+
+		lines = (ThreadLines){NULL, clients, clientCount, 0};
+		threadCount = poolWorkers < clientCount ? poolWorkers : clientCount;
+		for(i = 0; i < threadCount; i++){
+			err_thread = pthread_create(&threads1[i], NULL, &runThreadLines, &lines);
+			if(err_thread != 0){	//check if the thread is created successfully
+				printf("\n Error creating thread %d", i);
+			}
+			pinThread(threads1[i], i);
 		}
+		for(i = 0; i < threadCount; i++)
+			pthread_join(threads1[i], NULL);
 	}
+	else{
+		/*create threads for each depositor using the thread routine makeDeposites*/
+		for(i = 0; i < depositorCount; i++){
+			err_thread = pthread_create(&threads[i], NULL, &makeDeposits, &depositors[i]);	
+			if(err_thread != 0){	//check if thread is created successfully
+				printf("\n Error creating thread %d", i);
+			}
+			pinThread(threads[i], i);
+		}
 	
-	//join all of the depositor threads and makes sure that depositors are done before client threads begin
-	for (i = 0; i< depositorCount; i++)
-		pthread_join(threads[i], NULL); 
+		//join all of the depositor threads and makes sure that depositors are done before client threads begin
+		for (i = 0; i< depositorCount; i++)
+			pthread_join(threads[i], NULL); 
+		phaseMarks[PHASE_DEPOSITORS] = nowNanoseconds();
 	
-	/*create threads for each client using the thread routine makeTransactions*/
-	 for(i = 0; i < clientCount; i++){
-                err_thread = pthread_create(&threads1[i], NULL, &makeTransactions, &clients[i]);
-                if(err_thread != 0){	//check if the thread is created successfully
-                        printf("\n Error creating thread %d", i);
-                }
-        }
+		/*create threads for each client using the thread routine makeTransactions*/
+		 for(i = 0; i < clientCount; i++){
+	                err_thread = pthread_create(&threads1[i], NULL, &makeTransactions, &clients[i]);
+	                if(err_thread != 0){	//check if the thread is created successfully
+	                        printf("\n Error creating thread %d", i);
+	                }
+			pinThread(threads1[i], i);
+	        }
 	
-	 //join all of the client threads
-	for (i = 0; i< clientCount; i++)
-                pthread_join(threads1[i], NULL);
+		 //join all of the client threads
+		for (i = 0; i< clientCount; i++)
+	                pthread_join(threads1[i], NULL);
+	}
+	if(streamname != NULL && runStream(streamname, checkpointname, accountCount, resumeLines, resumeTransactions) != 0){	//the feed's client lines follow the input's
+		return 1;
+	}
+	phaseMarks[PHASE_CLIENTS] = nowNanoseconds();
+
+	if(queryReaders){
+		stopQueries();
+	}
 
-	pthread_mutex_destroy(&lock); 	//destroy the mutex lock from program
+	if(benchmark){
+		reportLatencies(nowNanoseconds() - runStart);
+	}
 
-	/*print out the account, along with its type and balance*/
-	for (i = 0; i < accountCount; i++){
-		printf("a%d type %s %d\n", accounts[i].accountNum, accounts[i].type, accounts[i].balance);
-		fprintf(output_fp, "a%d type %s %d\n", accounts[i].accountNum, accounts[i].type, accounts[i].balance);
+	if(lockMode == LOCK_OPTIMISTIC){
+		reportOptimisticCounts();
+	}
+
+	if(journaling){
+		stopJournal(accountCount, depositors, depositorCount, clients, clientCount);
 	}
 
+#ifdef LOCK_STATS
+	char reportname[4096];
+	char *outputDirEnd = strrchr(outputname, '/');		//the report is written next to the output file
+	snprintf(reportname, sizeof(reportname), "%.*sassignment_3_contention_report.txt",
+			outputDirEnd != NULL ? (int)(outputDirEnd - outputname + 1) : 0, outputname);
+	writeContentionReport(reportname, accountCount);
+#endif
+
+	destroyBankLock(&lock); 	//destroy the mutex lock from program
+
+	/*print out the account, along with its type and balance*/
+	writeBalances(accountCount, output_fp);
+
 	fclose(output_fp); //closes output file
+	phaseMarks[PHASE_OUTPUT] = nowNanoseconds();
 
-	/*deallocate the memory for each dynamic transaction array associated wit each  depositor*/
-	for(i = 0; i < depositorCount; i++){
-		free(depositors[i].transactions);
+	if(reportPhases){
+		fprintf(stderr, "phases parse %.6f depositors %.6f clients %.6f output %.6f total %.6f\n",
+			(phaseMarks[PHASE_PARSED] - phaseMarks[PHASE_START])/1e9, (phaseMarks[PHASE_DEPOSITORS] - phaseMarks[PHASE_PARSED])/1e9,
+			(phaseMarks[PHASE_CLIENTS] - phaseMarks[PHASE_DEPOSITORS])/1e9, (phaseMarks[PHASE_OUTPUT] - phaseMarks[PHASE_CLIENTS])/1e9,
+			(phaseMarks[PHASE_OUTPUT] - phaseMarks[PHASE_START])/1e9);
 	}
 
-	/*deallocate the memory for each dynamic transaction array associated with each client*/
-	for(i = 0; i < clientCount; i++){
-		free(clients[i].transactions);
+	int verifyFailed = goldenname != NULL && verifyBalances(goldenname, accountCount);	//compare with the golden output if given
+
+	//free the arena or image holding every depositor and client transaction along with the remaining dynamically allocated arrays
+	if(inputImage != NULL){
+		munmap(inputImage, inputImageSize);
 	}
-	
-	//free the memory for remaining five dynamically allocated arrays
-	free(accounts);
+	else{
+		munmap(transArena, transArenaSize);
+	}
+	freeAccountStore(accountCount);
 	free(depositors);
 	free(clients);
 	free(threads);
 	free(threads1);
 
-	return 0;
+	return verifyFailed;
 	
 }//main end
 
@@ -436,12 +688,25 @@ void *makeDeposits(void *depositor){
 	//must cast to be able to use depositor that was passed as an argument
 	Depo *threadDepositor = (Depo*)depositor;
 
+	runDepositBatch(threadDepositor->transactions, threadDepositor->numOfTrans);	//all of the depositor's transactions
+	flushLocalCounters();
+}
+
+/*thread routine for the thread engine with a set number of threads, running depositor or client lines until none are left*/
+void *runThreadLines(void *lines){
+
+	ThreadLines *threadLines = (ThreadLines*)lines;
 	int i;
-	for(i = 0; i < threadDepositor->numOfTrans; i++){	//loop through all of the depositor's transactions
-		pthread_mutex_lock(&lock);  // ENTRY REGION
-		deposit(threadDepositor->transactions[i].giveAccountNum, threadDepositor->transactions[i].amount, accounts[threadDepositor->transactions[i].giveAccountNum - 1].depositFee);	//critical region since we are manipulating the values of the accounts which are global
-		pthread_mutex_unlock(&lock); // EXIT REGION
+
+	while((i = __atomic_fetch_add(&threadLines->next, 1, __ATOMIC_RELAXED)) < threadLines->count){
+		if(threadLines->depositors != NULL){
+			makeDeposits(&threadLines->depositors[i]);
+		}
+		else{
+			makeTransactions(&threadLines->clients[i]);
+		}
 	}
+	return NULL;
 }
 
 /*thread routine for clients to process transactions concurrently*/
@@ -451,167 +716,4137 @@ void *makeTransactions(void *client){
 
 	int i;
         for(i = 0; i < threadClient->numOfTrans; i++){	//loop through all of the client's transactions
+		runClientTransaction(&threadClient->transactions[i]);
+        }
+	flushLocalCounters();
 
-                pthread_mutex_lock(&lock);  // ENTRY REGION
-		
-		//critical region
-		if (threadClient->transactions[i].transType == 'd'){		//if the transaction is a deposit call the deposit functin
-			 deposit(threadClient->transactions[i].giveAccountNum, threadClient->transactions[i].amount, accounts[threadClient->transactions[i].giveAccountNum - 1].depositFee);
-		}
+}
 
-		else if (threadClient->transactions[i].transType == 'w'){	//if the transaction is a withdraw call the withdraw function
-			withdraw(threadClient->transactions[i].takeAccountNum, threadClient->transactions[i].amount, accounts[threadClient->transactions[i].takeAccountNum - 1].withdrawFee);
-		}	
+/*runDeposit processes a single depositor transaction inside its critical region*/
+void runDeposit(Trans *transaction){
 
-		else if (threadClient->transactions[i].transType == 't'){	//if the transaction is a transfer call the transfer function
-			 transfer(threadClient->transactions[i].giveAccountNum, threadClient->transactions[i].takeAccountNum, threadClient->transactions[i].amount);
-		}
+	long long start = benchmark ? nowNanoseconds() : 0;
 
-                pthread_mutex_unlock(&lock); // EXIT REGION
-        }
+	//only deposits run while depositors are active, so accounts without overdraft can skip the lock entirely
+	if(atomicDeposits && !localCounters && accountConfig.overdraft[transaction->giveAccountNum - 1] == 0){
+		int balance = 0;
+		unsigned int version;
+		int status = depositAtomic(transaction->giveAccountNum, transaction->amount, accountConfig.depositFee[transaction->giveAccountNum - 1], &balance, &version);
+		if(journaling){
+			journalOutcome(transaction, status, 0, 0, balance, version);
+		}
+	}
+	else{
+		lockAccounts(transaction->giveAccountNum, transaction->giveAccountNum);  // ENTRY REGION
+		int status = deposit(transaction->giveAccountNum, transaction->amount, accountConfig.depositFee[transaction->giveAccountNum - 1]);	//critical region since we are manipulating the values of the accounts which are global
+		if(journaling){
+			journalTransaction(transaction, status);
+		}
+		unlockAccounts(transaction->giveAccountNum, transaction->giveAccountNum); // EXIT REGION
+	}
 
+	if(benchmark){
+		recordLatency(start);
+	}
 }
 
-/*deposit deposits the argument amount into the account with the 
- * argument accountNum and applys the value transFeeType argument to the account*/
-void deposit(int accountNum, int amount, int transFeeType){
+/*runClientTransaction processes a single client transaction inside its critical region*/
+void runClientTransaction(Trans *transaction){
 
-	int currTransactionNumber = accounts[accountNum - 1].numberOfAccTrans;
-	int tempBalance;
-	int tempInitialBalance;
+	int accountNum1;
+	int accountNum2;
 
-	if (accounts[accountNum - 1].overdraft == 0){		//if there is no overdraft associated with the account
-		tempBalance = accounts[accountNum - 1].balance;
-		if (currTransactionNumber+1 > accounts[accountNum - 1].transactionNum){	//check if the additional fee should be applied to transaction
-			  tempBalance -= accounts[accountNum - 1].additionalFee;
-		}
+	transactionAccounts(transaction, &accountNum1, &accountNum2);	//only the accounts the transaction touches need to be locked
 
-		tempBalance += amount;		//add amount to the account balance
-		tempBalance -= transFeeType;	//subtract the fee from the account balance
+	long long start = benchmark ? nowNanoseconds() : 0;
 
-		if (tempBalance >= 0){		//if the balance >= 0 after the transaction then process it; if it is negative then do not process it
-			accounts[accountNum - 1].numberOfAccTrans++;
-			accounts[accountNum - 1].balance = tempBalance;
+	if (lockMode == LOCK_OPTIMISTIC){
+		runOptimisticTransaction(transaction);
+	}
+	//with per account locks transfers hold one account at a time through the two phases, the global lock takes both at once
+	else if (transaction->transType == 't' && lockMode == LOCK_ACCOUNT){
+		runTransfer(transaction);
+	}
+	else{
+		lockAccounts(accountNum1, accountNum2);  // ENTRY REGION
+		int status = applyTransaction(transaction);		 //critical region
+		if(journaling){
+			journalTransaction(transaction, status);
 		}
+		unlockAccounts(accountNum1, accountNum2); // EXIT REGION
 	}
 
-	else{									//if the account has overdraft protection
-		tempInitialBalance = accounts[accountNum - 1].balance;
-		tempBalance = accounts[accountNum - 1].balance;
-		tempBalance += amount;
-		tempBalance -= transFeeType;
-	
-		if(currTransactionNumber+1 > accounts[accountNum - 1].transactionNum){	//check if the additional fee should be applied
-			tempBalance -= accounts[accountNum - 1].additionalFee;
+	if(benchmark){
+		recordLatency(start);
+	}
+}
+
+/*runTransfer runs a transfer as its separate phases, each in a critical region holding only the account the phase
+ * touches: reserve on the sending account, commit on the receiving account and release on the sending account if
+ * the commit was rejected. Other transactions can run on either account between the phases. While journaling, each
+ * phase that changes an account takes the account's next journal version along with its balance, and the record is
+ * written once the last phase is done*/
+int runTransfer(Trans *transaction){
+
+	int giveAccountNum = transaction->giveAccountNum;
+	int takeAccountNum = transaction->takeAccountNum;
+	int takeBalance = 0;
+	int giveBalance = 0;
+	unsigned int takeVersion = 0;
+	unsigned int giveVersion = 0;
+	int status;
+
+	lockAccounts(takeAccountNum, takeAccountNum);
+	status = transferReserve(takeAccountNum, transaction->amount);
+	if(journaling && status == TRANS_OK){
+		takeVersion = ++accounts[takeAccountNum - 1].journalVersion;
+		takeBalance = accounts[takeAccountNum - 1].balance;
+	}
+	unlockAccounts(takeAccountNum, takeAccountNum);
+
+	if(status == TRANS_OK){
+		lockAccounts(giveAccountNum, giveAccountNum);
+		status = transferCommit(giveAccountNum, transaction->amount);
+		if(journaling && status == TRANS_OK){
+			giveVersion = ++accounts[giveAccountNum - 1].journalVersion;
+			giveBalance = accounts[giveAccountNum - 1].balance;
 		}
+		unlockAccounts(giveAccountNum, giveAccountNum);
 
-		if(tempBalance < 0){	//this is where you must implement if u should charge overdraft or not
-			int j = -500;
-			int i = -1;
-				
-			while (tempInitialBalance < j){	//figure out what range the balance is in before the transaction is applied
-				i -= 500;	
-				j -= 500;
+		if(status != TRANS_OK){
+			lockAccounts(takeAccountNum, takeAccountNum);
+			transferRelease(takeAccountNum, transaction->amount);
+			if(journaling){
+				takeVersion = ++accounts[takeAccountNum - 1].journalVersion;
+				takeBalance = accounts[takeAccountNum - 1].balance;
 			}
-			
-			while (tempBalance < j){	//figure out the difference in value between the inital range and the new range of the balance
-				 if(j == -5000){	//if j is -5000 then overdraft limit has been exceeded and do not process transaction(balance < -5000)
-                                        return;
-                                }
+			unlockAccounts(takeAccountNum, takeAccountNum);
+		}
+	}
 
-				tempBalance -= accounts[accountNum - 1].overdraftFee;	//each iteration of the loop apply overdraft fee
-				j -= 500;						//update value of j and i
-				i -= 500;
-			}
+	if(journaling){
+		journalOutcome(transaction, status, takeBalance, takeVersion, giveBalance, giveVersion);
+	}
+	return status;
+}
 
-			 if(tempInitialBalance > 0 && tempBalance < 0){			//this is the case for if the balance goes from a positive value to a negative one caused by the current transaction
-                                tempBalance -= accounts[accountNum - 1].overdraftFee;
-                        }
-		}
-		accounts[accountNum - 1].balance = tempBalance;	//set the balance of the account to the temp balance calculated
-		accounts[accountNum - 1].numberOfAccTrans++;	//increment the number of transactions made using the account
+/*transactionAccounts determines which accounts a transaction touches (both are the same for a deposit or withdraw)*/
+void transactionAccounts(Trans *transaction, int *accountNum1, int *accountNum2){
+
+	if (transaction->transType == 'd'){
+		*accountNum1 = *accountNum2 = transaction->giveAccountNum;
+	}
+	else if (transaction->transType == 'w'){
+		*accountNum1 = *accountNum2 = transaction->takeAccountNum;
+	}
+	else{
+		*accountNum1 = transaction->takeAccountNum;
+		*accountNum2 = transaction->giveAccountNum;
 	}
 }
 
-/*withdraw function removes the value of the amount argument from the account
- * with the account number accountNum and applys the value of transFeeType to the account*/
-void withdraw(int accountNum, int amount, int transFeeType){
-	
-	int currTransactionNumber = accounts[accountNum - 1].numberOfAccTrans;
-	int tempBalance;
-	int tempInitialBalance;
+/*applyTransaction applies a transaction to its accounts and returns its status; the caller must make sure no other
+ * thread touches the accounts*/
+int applyTransaction(Trans *transaction){
 
-        if (accounts[accountNum - 1].overdraft == 0){           //if there is no overdraft associated with the account
-                tempBalance = accounts[accountNum - 1].balance;
-                if (currTransactionNumber+1 > accounts[accountNum - 1].transactionNum){
-                          tempBalance -= accounts[accountNum - 1].additionalFee;
-                }
+	if (transaction->transType == 'd'){		//if the transaction is a deposit call the deposit functin
+		return deposit(transaction->giveAccountNum, transaction->amount, accountConfig.depositFee[transaction->giveAccountNum - 1]);
+	}
 
-                tempBalance -= amount;
-                tempBalance -= transFeeType;
+	else if (transaction->transType == 'w'){	//if the transaction is a withdraw call the withdraw function
+		return withdraw(transaction->takeAccountNum, transaction->amount, accountConfig.withdrawFee[transaction->takeAccountNum - 1]);
+	}	
 
-                if (tempBalance >= 0){
-                        accounts[accountNum - 1].numberOfAccTrans++;
-                        accounts[accountNum - 1].balance = tempBalance;
-                }
-        }
+	else if (transaction->transType == 't'){	//if the transaction is a transfer call the transfer function
+		return transfer(transaction->giveAccountNum, transaction->takeAccountNum, transaction->amount);
+	}
+	return TRANS_REJECTED;
+}
 
-	else{                                                                   //if the account has overdraft protection
-                tempInitialBalance = accounts[accountNum - 1].balance;
-		tempBalance = accounts[accountNum - 1].balance;
-		tempBalance -= amount;
-                tempBalance -= transFeeType;
+/*beginAccountWrite marks the accounts accountNum1 and accountNum2 as being changed for the balance queries, by
+ * making their seqlock sequences odd. The caller must hold the accounts*/
+static inline void beginAccountWrite(int accountNum1, int accountNum2){
+	__atomic_store_n(&accounts[accountNum1 - 1].snapshotSequence, accounts[accountNum1 - 1].snapshotSequence + 1, __ATOMIC_RELAXED);
+	if(accountNum2 != accountNum1){
+		__atomic_store_n(&accounts[accountNum2 - 1].snapshotSequence, accounts[accountNum2 - 1].snapshotSequence + 1, __ATOMIC_RELAXED);
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);	//the odd sequences must be seen before any of the changes
+}
 
-                if(currTransactionNumber+1 > accounts[accountNum - 1].transactionNum){
-                        tempBalance -= accounts[accountNum - 1].additionalFee;
-                }
+/*endAccountWrite publishes the changes made to the accounts since beginAccountWrite by making their sequences even again*/
+static inline void endAccountWrite(int accountNum1, int accountNum2){
+	__atomic_store_n(&accounts[accountNum1 - 1].snapshotSequence, accounts[accountNum1 - 1].snapshotSequence + 1, __ATOMIC_RELEASE);
+	if(accountNum2 != accountNum1){
+		__atomic_store_n(&accounts[accountNum2 - 1].snapshotSequence, accounts[accountNum2 - 1].snapshotSequence + 1, __ATOMIC_RELEASE);
+	}
+}
 
-                if(tempBalance < 0){       //this is where you must implement if u should charge overdraft or not (SAME CHECK AS DEPOSIT FUNCTION ABOVE)
-                        int j = -500;
-                        int i = -1;
+#define SPIN_ROUNDS 64		//attempts a waiter makes at a lock before parking on its futex
+#define SPIN_BACKOFF_MAX 64	//most pause instructions between two attempts, the wait doubles after each one
+#define CONTENTION_STEP 4	//added to the contention estimate by a holder that had to wait, one is taken off by one that did not
+#define CONTENTION_MAX 64	//cap on the contention estimate
+#define CONTENTION_QUEUE 16	//contention estimate at which the adaptive lock starts queueing its waiters
 
-                        while (tempInitialBalance < j){ //gets you the range of overdraft for your inital balance
-                                i -= 500;
-                                j -= 500;
-                        }
+//states of a queue node
+enum mcsState{
+	MCS_READY,		//the waiter is at the head of the queue
+	MCS_WAITING,		//the waiter is spinning on its node
+	MCS_PARKED		//the waiter is parked on the futex of its node
+};
 
-                        while (tempBalance <  j){
+__thread McsNode threadMcsNode;		//queue node of the calling thread
+int lockSpinRounds = -1;		//SPIN_ROUNDS, or 0 on a single CPU where the holder cannot let go while a waiter spins
 
-				if(j == -5000){		//if overdraft limit is exceeded then do not process transaction (balance < -5000)
-                                        return;
-                                }
+/*futexWait parks the calling thread while the word still holds value, futexWake wakes one thread parked on the word*/
+static inline void futexWait(unsigned int *word, unsigned int value){
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
 
-                                tempBalance -= accounts[accountNum - 1].overdraftFee;
-                                j -= 500;
-				i -= 500;
-                        }
+static inline void futexWake(unsigned int *word){
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
 
-			if(tempInitialBalance > 0 && tempBalance < 0){	//case where balance goes from positive to negative after transaction is applied
-				tempBalance -= accounts[accountNum - 1].overdraftFee;
-			}
-                }
-		accounts[accountNum - 1].balance = tempBalance;
-                accounts[accountNum - 1].numberOfAccTrans++;
-        }
+/*spinUntil spins on the word with exponential backoff until it holds value, returning 0 if it gave up first*/
+static inline int spinUntil(unsigned int *word, unsigned int value){
+
+	int backoff = 1;
+	int round;
+	int i;
+
+	for(round = 0; round < lockSpinRounds; round++){
+		if(__atomic_load_n(word, __ATOMIC_ACQUIRE) == value){
+			return 1;
+		}
+		for(i = 0; i < backoff; i++){
+			__builtin_ia32_pause();
+		}
+		if(backoff < SPIN_BACKOFF_MAX){
+			backoff *= 2;
+		}
+	}
+	return 0;
 }
 
-/*transfer function transfers the value of the argument amount from the account with the account
- * number takeAccountNum and gives to the account with number takeAccountNum*/ 
-void transfer(int giveAccountNum, int takeAccountNum, int amount){
-	int initialBalance = accounts[takeAccountNum - 1].balance;
-	withdraw(takeAccountNum, amount, accounts[takeAccountNum - 1].transferFee);	//a withdraw occurs using the takeAccountNum, value, and transferFee
+/*initBankLock initialises a lock as the primitive selected on the command line, returning 0 on success*/
+int initBankLock(BankLock *bankLock){
 
-	if(initialBalance == accounts[takeAccountNum - 1].balance){	//transfer not able to take place since unable to remove money from intial account
-		return;
+	if(lockPrimitive == PRIMITIVE_MUTEX){
+		return pthread_mutex_init(&bankLock->mutex, NULL);
+	}
+	if(lockSpinRounds < 0){
+		lockSpinRounds = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_ROUNDS : 0;
 	}
+	bankLock->word = 0;
+	bankLock->contention = 0;
+	bankLock->tail = NULL;
+	return 0;
+}
 
-	initialBalance =  accounts[giveAccountNum - 1].balance;
+/*destroyBankLock releases anything held by a lock*/
+void destroyBankLock(BankLock *bankLock){
 
-	deposit(giveAccountNum, amount, accounts[giveAccountNum - 1].transferFee);	//a deposit occurs using the giveAccountNum, value, and transferFee
+	if(lockPrimitive == PRIMITIVE_MUTEX){
+		pthread_mutex_destroy(&bankLock->mutex);
+	}
+}
+
+/*takeLockWord takes the word of a spin-then-park lock for a thread that found it held. The thread spins on it with
+ * backoff while the holder is likely to let go soon and then parks on the futex, marking the word 2 so the holder
+ * knows to wake a thread when it lets go*/
+static void takeLockWord(BankLock *bankLock){
+
+	unsigned int expected = 0;
+	int backoff = 1;
+	int round;
+	int i;
+
+	for(round = 0; round < lockSpinRounds; round++){
+		if(__atomic_load_n(&bankLock->word, __ATOMIC_RELAXED) == 0 &&
+			__atomic_compare_exchange_n(&bankLock->word, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			return;
+		}
+		expected = 0;
+		for(i = 0; i < backoff; i++){
+			__builtin_ia32_pause();
+		}
+		if(backoff < SPIN_BACKOFF_MAX){
+			backoff *= 2;
+		}
+	}
+
+	while(__atomic_exchange_n(&bankLock->word, 2, __ATOMIC_ACQUIRE) != 0){
+		futexWait(&bankLock->word, 2);
+	}
+}
+
+/*queueForLock takes a spin-then-park lock through its queue. Only the waiter at the head of the queue goes for the
+ * lock word, the others spin or park on their own node, so a contended lock's cache line is not fought over by every
+ * waiter. The head passes the queue on as soon as it holds the word*/
+static void queueForLock(BankLock *bankLock){
+
+	McsNode *node = &threadMcsNode;
+	McsNode *previous;
+
+	node->next = NULL;
+	node->state = MCS_WAITING;
+	previous = __atomic_exchange_n(&bankLock->tail, node, __ATOMIC_ACQ_REL);
+	if(previous != NULL){
+		__atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+		if(!spinUntil(&node->state, MCS_READY)){
+			unsigned int expected = MCS_WAITING;
+			__atomic_compare_exchange_n(&node->state, &expected, MCS_PARKED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+			while(__atomic_load_n(&node->state, __ATOMIC_ACQUIRE) != MCS_READY){
+				futexWait(&node->state, MCS_PARKED);
+			}
+		}
+	}
+
+	unsigned int expected = 0;
+	if(!__atomic_compare_exchange_n(&bankLock->word, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+		takeLockWord(bankLock);
+	}
+
+	/*hand the head of the queue to the next waiter, or empty the queue if there is none*/
+	McsNode *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+	if(next == NULL){
+		McsNode *last = node;
+		if(__atomic_compare_exchange_n(&bankLock->tail, &last, NULL, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+			return;
+		}
+		while((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL){	//a waiter is linking itself in
+			__builtin_ia32_pause();
+		}
+	}
+	if(__atomic_exchange_n(&next->state, MCS_READY, __ATOMIC_RELEASE) == MCS_PARKED){
+		futexWake(&next->state);
+	}
+}
+
+/*acquireBankLock takes a lock. An uncontended spin-then-park lock costs one compare and swap. A contended one
+ * spins and parks, and goes through the queue when it is an MCS lock or an adaptive lock whose recent holders
+ * mostly had to wait*/
+void acquireBankLock(BankLock *bankLock){
+
+	if(lockPrimitive == PRIMITIVE_MUTEX){
+		pthread_mutex_lock(&bankLock->mutex);
+		return;
+	}
+
+	unsigned int expected = 0;
+	if(__atomic_compare_exchange_n(&bankLock->word, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+		if(bankLock->contention > 0){		//only the holder writes the estimate
+			__atomic_store_n(&bankLock->contention, bankLock->contention - 1, __ATOMIC_RELAXED);
+		}
+		return;
+	}
+
+	if(lockPrimitive == PRIMITIVE_MCS ||
+		(lockPrimitive == PRIMITIVE_ADAPTIVE && __atomic_load_n(&bankLock->contention, __ATOMIC_RELAXED) >= CONTENTION_QUEUE)){
+		queueForLock(bankLock);
+	}
+	else{
+		takeLockWord(bankLock);
+	}
+	if(bankLock->contention < CONTENTION_MAX){
+		__atomic_store_n(&bankLock->contention, bankLock->contention + CONTENTION_STEP, __ATOMIC_RELAXED);
+	}
+}
+
+/*releaseBankLock lets go of a lock, waking one parked thread if there are any*/
+void releaseBankLock(BankLock *bankLock){
+
+	if(lockPrimitive == PRIMITIVE_MUTEX){
+		pthread_mutex_unlock(&bankLock->mutex);
+		return;
+	}
+
+	if(__atomic_exchange_n(&bankLock->word, 0, __ATOMIC_RELEASE) == 2){
+		futexWake(&bankLock->word);
+	}
+}
+
+/*lockVersion takes an account in optimistic mode by moving its version word from even to odd, which makes every
+ * optimistic transaction that read the account fail to commit. unlockVersion makes the word even again*/
+static inline void lockVersion(int accountNum){
+
+	unsigned int *version = &accounts[accountNum - 1].snapshotSequence;
+	unsigned int seen;
+	int backoff = 1;
+	int i;
+
+	for(;;){
+		seen = __atomic_load_n(version, __ATOMIC_RELAXED);
+		if((seen & 1) == 0 && __atomic_compare_exchange_n(version, &seen, seen + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			return;
+		}
+		if(backoff < SPIN_BACKOFF_MAX){
+			for(i = 0; i < backoff; i++){
+				__builtin_ia32_pause();
+			}
+			backoff *= 2;
+		}
+		else{
+			sched_yield();		//the holder may be waiting for this CPU
+		}
+	}
+}
+
+static inline void unlockVersion(int accountNum){
+	__atomic_store_n(&accounts[accountNum - 1].snapshotSequence, accounts[accountNum - 1].snapshotSequence + 1, __ATOMIC_RELEASE);
+}
+
+/*lockAccounts enters the critical region for a transaction on the accounts accountNum1 and accountNum2
+ * (both are the same for a deposit or withdraw). In per-account mode the two account locks are always
+ * taken in ascending account number order so that two transfers can never deadlock on each other. In
+ * optimistic mode the version words of the accounts are taken as locks, in the same order*/
+void lockAccounts(int accountNum1, int accountNum2){
+
+#ifdef LOCK_STATS
+	long long waitStart = nowNanoseconds();
+#endif
+
+	if (lockMode == LOCK_GLOBAL){
+		acquireBankLock(&lock);
+	}
+	else if (lockMode == LOCK_OPTIMISTIC){
+		lockVersion(accountNum1 <= accountNum2 ? accountNum1 : accountNum2);
+		if (accountNum2 != accountNum1){
+			lockVersion(accountNum1 <= accountNum2 ? accountNum2 : accountNum1);
+		}
+	}
+	else if (accountNum1 <= accountNum2){	//order the accounts so the lower account number is locked first
+		acquireBankLock(&accounts[accountNum1 - 1].accountLock);
+		if (accountNum2 != accountNum1){	//a transfer to the same account only needs the one lock
+			acquireBankLock(&accounts[accountNum2 - 1].accountLock);
+		}
+	}
+	else{
+		acquireBankLock(&accounts[accountNum2 - 1].accountLock);
+		acquireBankLock(&accounts[accountNum1 - 1].accountLock);
+	}
+
+#ifdef LOCK_STATS
+	recordLockAcquired(accountNum1, accountNum2, waitStart);
+#endif
+
+	if(queryReaders && lockMode != LOCK_OPTIMISTIC){	//an odd version word already tells the readers
+		beginAccountWrite(accountNum1, accountNum2);
+	}
+}
+
+/*unlockAccounts exits the critical region entered by lockAccounts with the same arguments*/
+void unlockAccounts(int accountNum1, int accountNum2){
+
+#ifdef LOCK_STATS
+	recordLockReleased();
+#endif
+
+	if(queryReaders && lockMode != LOCK_OPTIMISTIC){
+		endAccountWrite(accountNum1, accountNum2);
+	}
+
+	if (lockMode == LOCK_GLOBAL){
+		releaseBankLock(&lock);
+		return;
+	}
+
+	if (lockMode == LOCK_OPTIMISTIC){
+		unlockVersion(accountNum1);
+		if (accountNum2 != accountNum1){
+			unlockVersion(accountNum2);
+		}
+		return;
+	}
+
+	releaseBankLock(&accounts[accountNum1 - 1].accountLock);
+	if (accountNum2 != accountNum1){
+		releaseBankLock(&accounts[accountNum2 - 1].accountLock);
+	}
+}
+
+#define LOCAL_COUNTER_SLOTS 256		//number of accounts a thread can hold transaction counts for before merging
+
+//per thread transaction counts for the local counters mode, a small direct mapped table of accounts
+typedef struct localCounts{
+	int accountNum[LOCAL_COUNTER_SLOTS];	//account held in each slot, 0 if the slot is empty
+	int count[LOCAL_COUNTER_SLOTS];		//transactions counted on the account since the last merge
+} LocalCounts;
+
+__thread LocalCounts threadCounts;	//transaction counts of the calling thread
+
+/*addLocalCount adds to the calling thread's transaction count of the account, merging the slot's previous
+ * account into the shared count first if the slot is taken*/
+static inline void addLocalCount(int accountNum, int amount){
+
+	int slot = accountNum & (LOCAL_COUNTER_SLOTS - 1);
+
+	if(threadCounts.accountNum[slot] != accountNum){
+		if(threadCounts.count[slot] != 0){
+			__atomic_add_fetch(&accounts[threadCounts.accountNum[slot] - 1].numberOfAccTrans, threadCounts.count[slot], __ATOMIC_RELAXED);
+		}
+		threadCounts.accountNum[slot] = accountNum;
+		threadCounts.count[slot] = 0;
+	}
+	threadCounts.count[slot] += amount;
+}
+
+/*flushLocalCounters merges the calling thread's transaction counts into the shared counts of the accounts, along with
+ * its optimistic transaction counts. It is called at every epoch boundary: the end of a thread, a work-stealing slice,
+ * a batch or a pipeline line*/
+void flushLocalCounters(void){
+
+	int slot;
+
+	flushOptimisticCounts();
+	if(!localCounters){
+		return;
+	}
+
+	for(slot = 0; slot < LOCAL_COUNTER_SLOTS; slot++){
+		if(threadCounts.count[slot] != 0){
+			__atomic_add_fetch(&accounts[threadCounts.accountNum[slot] - 1].numberOfAccTrans, threadCounts.count[slot], __ATOMIC_RELAXED);
+			threadCounts.count[slot] = 0;
+		}
+	}
+}
+
+//private copies of the accounts an optimistic transaction works on
+typedef struct optimisticSet{
+	int accountNum[2];	//accounts the transaction touches, both the same for a deposit or withdraw
+	Acc record[2];		//copy of each account's balance and number of transactions
+} OptimisticSet;
+
+__thread OptimisticSet *optimisticSet;	//copies the calling thread's fee logic works on, NULL to work on the accounts
+
+/*accountRecord returns the account the fee logic reads and changes: the calling thread's private copy during an
+ * optimistic transaction and the shared account otherwise*/
+static inline Acc *accountRecord(int accountNum){
+
+	if(optimisticSet != NULL){
+		return &optimisticSet->record[accountNum == optimisticSet->accountNum[0] ? 0 : 1];
+	}
+	return &accounts[accountNum - 1];
+}
+
+/*additionalFeeDue returns 1 if the next transaction on the account is over the transaction limit and must pay the
+ * additional fee. With local counters the shared count is not up to date, so the limit is kept exactly by the
+ * account's fee free tickets instead: every transaction counted takes one and every one taken back returns it, so
+ * they always hold transactionNum less the count, even when a transfer's phases interleave with other transactions*/
+static inline int additionalFeeDue(int accountNum){
+
+	if(localCounters){
+		return __atomic_load_n(&accounts[accountNum - 1].feeFreeTickets, __ATOMIC_RELAXED) <= 0;
+	}
+	return accountRecord(accountNum)->numberOfAccTrans+1 > accountConfig.transactionNum[accountNum - 1];
+}
+
+/*countTransaction increments the number of transactions made on the account once a transaction is processed*/
+static inline void countTransaction(int accountNum){
+
+	if(!localCounters){
+		accountRecord(accountNum)->numberOfAccTrans++;
+		return;
+	}
+
+	__atomic_sub_fetch(&accounts[accountNum - 1].feeFreeTickets, 1, __ATOMIC_RELAXED);
+	addLocalCount(accountNum, 1);
+}
+
+/*uncountTransaction takes back the last transaction counted on the account when a transfer is refunded*/
+static inline void uncountTransaction(int accountNum){
+
+	if(!localCounters){
+		accountRecord(accountNum)->numberOfAccTrans--;
+		return;
+	}
+
+	__atomic_add_fetch(&accounts[accountNum - 1].feeFreeTickets, 1, __ATOMIC_RELAXED);	//give back the ticket the refunded withdraw took
+	addLocalCount(accountNum, -1);
+}
+
+/*deposit deposits the argument amount into the account with the 
+ * argument accountNum and applys the value transFeeType argument to the account. Returns TRANS_OK if the deposit
+ * was processed and TRANS_REJECTED if it was not*/
+int deposit(int accountNum, int amount, int transFeeType){
+
+	int tempBalance;
+	int tempInitialBalance;
+
+	if (accountConfig.overdraft[accountNum - 1] == 0){		//if there is no overdraft associated with the account
+		tempBalance = accountRecord(accountNum)->balance;
+		if (additionalFeeDue(accountNum)){	//check if the additional fee should be applied to transaction
+			  tempBalance -= accountConfig.additionalFee[accountNum - 1];
+		}
+
+		tempBalance += amount;		//add amount to the account balance
+		tempBalance -= transFeeType;	//subtract the fee from the account balance
+
+		if (tempBalance < 0){		//if the balance >= 0 after the transaction then process it; if it is negative then do not process it
+			return TRANS_REJECTED;
+		}
+		countTransaction(accountNum);
+		accountRecord(accountNum)->balance = tempBalance;
+	}
+
+	else{									//if the account has overdraft protection
+		tempInitialBalance = accountRecord(accountNum)->balance;
+		tempBalance = accountRecord(accountNum)->balance;
+		tempBalance += amount;
+		tempBalance -= transFeeType;
+	
+		if(additionalFeeDue(accountNum)){	//check if the additional fee should be applied
+			tempBalance -= accountConfig.additionalFee[accountNum - 1];
+		}
+
+		if(tempBalance < 0 && !overdraftCharge(tempInitialBalance, tempBalance, accountConfig.overdraftFee[accountNum - 1], &tempBalance)){
+			return TRANS_REJECTED;		//overdraft limit has been exceeded so do not process transaction
+		}
+		accountRecord(accountNum)->balance = tempBalance;	//set the balance of the account to the temp balance calculated
+		countTransaction(accountNum);	//increment the number of transactions made using the account
+	}
+	return TRANS_OK;
+}
+
+/*claimJournalVersion gives the next journal version of an account changed with compare and swap. It must be called
+ * after the balance word the swap expects was read and before the swap: a swap that succeeds after another one read
+ * that one's result first, so it also claimed its version later, and the versions follow the order of the swaps*/
+static inline unsigned int claimJournalVersion(Acc *account){
+	return __atomic_add_fetch(&account->journalVersion, 1, __ATOMIC_ACQ_REL);
+}
+
+/*depositAtomic is the lock-free version of deposit for an account without overdraft. The balance and
+ * number of transactions are packed into one 64-bit word and updated together with compare-and-swap, so
+ * it must only run while no other thread changes the account under a lock (the depositor phase). The balance
+ * it left is stored in balance, and while journaling the journal version of the change is stored in version (0 if
+ * the deposit was rejected)*/
+int depositAtomic(int accountNum, int amount, int transFeeType, int *balance, unsigned int *version){
+
+	Acc *account = &accounts[accountNum - 1];
+	AccBalance oldState;
+	AccBalance newState;
+
+	*version = 0;
+	oldState.balanceWord = __atomic_load_n(&account->balanceWord, __ATOMIC_ACQUIRE);
+	do{
+		if(journaling){
+			*version = claimJournalVersion(account);
+		}
+		newState.balance = oldState.balance;
+		if (oldState.numberOfAccTrans+1 > accountConfig.transactionNum[accountNum - 1]){	//check if the additional fee should be applied to transaction
+			newState.balance -= accountConfig.additionalFee[accountNum - 1];
+		}
+
+		newState.balance += amount;
+		newState.balance -= transFeeType;
+
+		if (newState.balance < 0){		//same as deposit, a negative balance means the transaction is not processed
+			*version = 0;
+			return TRANS_REJECTED;
+		}
+		newState.numberOfAccTrans = oldState.numberOfAccTrans + 1;
+
+	}while(!__atomic_compare_exchange_n(&account->balanceWord, &oldState.balanceWord, newState.balanceWord, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	*balance = newState.balance;
+	return TRANS_OK;
+}
+
+/*withdraw function removes the value of the amount argument from the account
+ * with the account number accountNum and applys the value of transFeeType to the account.
+ * Returns TRANS_OK if the withdraw was processed and TRANS_REJECTED if it was not*/
+int withdraw(int accountNum, int amount, int transFeeType){
+	
+	int tempBalance;
+	int tempInitialBalance;
+
+        if (accountConfig.overdraft[accountNum - 1] == 0){           //if there is no overdraft associated with the account
+                tempBalance = accountRecord(accountNum)->balance;
+                if (additionalFeeDue(accountNum)){
+                          tempBalance -= accountConfig.additionalFee[accountNum - 1];
+                }
+
+                tempBalance -= amount;
+                tempBalance -= transFeeType;
+
+                if (tempBalance < 0){
+                        return TRANS_REJECTED;
+                }
+                countTransaction(accountNum);
+                accountRecord(accountNum)->balance = tempBalance;
+        }
+
+	else{                                                                   //if the account has overdraft protection
+                tempInitialBalance = accountRecord(accountNum)->balance;
+		tempBalance = accountRecord(accountNum)->balance;
+		tempBalance -= amount;
+                tempBalance -= transFeeType;
+
+                if(additionalFeeDue(accountNum)){
+                        tempBalance -= accountConfig.additionalFee[accountNum - 1];
+                }
+
+                if(tempBalance < 0 && !overdraftCharge(tempInitialBalance, tempBalance, accountConfig.overdraftFee[accountNum - 1], &tempBalance)){
+                        return TRANS_REJECTED;         //overdraft limit has been exceeded so do not process transaction
+                }
+		accountRecord(accountNum)->balance = tempBalance;
+                countTransaction(accountNum);
+        }
+	return TRANS_OK;
+}
+
+/*overdraftCharge is the shared fee engine for deposit and withdraw on an account with overdraft. newBalance is the
+ * negative balance after the transaction and its fees were applied to initialBalance. The balance starts in the tier
+ * holding initialBalance and an overdraft fee is charged for every tier boundary it falls through, where each fee can
+ * itself push it through another boundary. With n fees charged the balance is newBalance - n*fee against a boundary of
+ * start - n*tierWidth, so the number of crossings is the shortfall below the starting tier divided by (tierWidth - fee),
+ * rounded up. One more fee is charged if the balance went from positive to negative. Returns 0 and leaves result
+ * unchanged if the overdraft limit boundary would be crossed, otherwise stores the final balance in result and returns 1*/
+int overdraftCharge(int initialBalance, int newBalance, int overdraftFee, int *result){
+
+	long long width = overdraftTiers.tierWidth;
+	long long tiers = overdraftTiers.limit / width;		//number of tiers above the overdraft limit
+	long long start = 1;					//tier holding the initial balance, tier 1 is [-tierWidth, 0)
+	long long crossings = 0;				//number of tier boundaries the balance falls through
+
+	if(initialBalance < -width){
+		start = (-(long long)initialBalance + width - 1)/width;
+	}
+
+	long long shortfall = -start*width - newBalance;	//how far the new balance is below the starting tier
+	if(shortfall > 0){
+		if(overdraftFee >= width){			//every fee pushes the balance through another boundary
+			return 0;
+		}
+		crossings = (shortfall + (width - overdraftFee) - 1)/(width - overdraftFee);
+		if(start <= tiers && crossings > tiers - start){	//the limit boundary would be crossed
+			return 0;
+		}
+	}
+
+	long long balance = newBalance - crossings*overdraftFee;
+	if(initialBalance > 0 && balance < 0){			//balance went from a positive value to a negative one
+		balance -= overdraftFee;
+	}
+
+	*result = (int)balance;
+	return 1;
+}
+
+/*transfer function transfers the value of the argument amount from the account with the account number
+ * takeAccountNum and gives to the account with number giveAccountNum, with both accounts already held by the
+ * caller. It runs the three phases of a two-phase transfer back to back. Returns TRANS_OK if the transfer was
+ * processed and TRANS_REJECTED if it was not*/
+int transfer(int giveAccountNum, int takeAccountNum, int amount){
+
+	if(transferReserve(takeAccountNum, amount) != TRANS_OK){	//transfer not able to take place since unable to remove money from intial account
+		return TRANS_REJECTED;
+	}
+
+	if(transferCommit(giveAccountNum, amount) != TRANS_OK){	//if receiving account is unable to process the depost transaction then refund the original sender
+		transferRelease(takeAccountNum, amount);
+		return TRANS_REJECTED;
+	}
+	return TRANS_OK;
+}
+
+/*transferReserve is the first phase of a transfer: a withdraw of amount and the transfer fee from the sending
+ * account takeAccountNum. It only touches the sending account*/
+int transferReserve(int takeAccountNum, int amount){
+	return withdraw(takeAccountNum, amount, accountConfig.transferFee[takeAccountNum - 1]);
+}
+
+/*transferCommit is the second phase of a transfer: a deposit of amount less the transfer fee into the receiving
+ * account giveAccountNum. It only touches the receiving account*/
+int transferCommit(int giveAccountNum, int amount){
+	return deposit(giveAccountNum, amount, accountConfig.transferFee[giveAccountNum - 1]);
+}
+
+/*transferRelease undoes a reservation when the commit was rejected, refunding the amount and the transfer fee to
+ * the sending account takeAccountNum and taking back its transaction. It only touches the sending account*/
+void transferRelease(int takeAccountNum, int amount){
+	accountRecord(takeAccountNum)->balance += amount;
+	accountRecord(takeAccountNum)->balance += accountConfig.transferFee[takeAccountNum - 1];
+	uncountTransaction(takeAccountNum);
+}
+
+#define OPTIMISTIC_ATTEMPTS 16	//attempts at an optimistic transaction before it takes its accounts like a pessimistic one
+#define OPTIMISTIC_BACKOFF_MAX 1024	//most pause instructions between two attempts, the wait doubles after each abort
+
+//optimistic transaction counts of a thread, merged into the totals at every epoch boundary
+typedef struct optimisticCounts{
+	long long transactions;	//transactions run optimistically
+	long long readOnly;	//transactions that were rejected, which commit without writing
+	long long aborts;	//attempts that found an account changed or being changed
+	long long retried;	//transactions that aborted at least once
+	long long fallbacks;	//transactions that ran out of attempts and took their accounts
+} OptimisticCounts;
+
+__thread OptimisticCounts threadOptimistic;	//counts of the calling thread since its last merge
+OptimisticCounts optimisticTotals;		//merged counts of every thread
+
+/*flushOptimisticCounts merges the calling thread's optimistic transaction counts into the totals*/
+void flushOptimisticCounts(void){
+
+	if(threadOptimistic.transactions == 0){
+		return;
+	}
+	__atomic_add_fetch(&optimisticTotals.transactions, threadOptimistic.transactions, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&optimisticTotals.readOnly, threadOptimistic.readOnly, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&optimisticTotals.aborts, threadOptimistic.aborts, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&optimisticTotals.retried, threadOptimistic.retried, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&optimisticTotals.fallbacks, threadOptimistic.fallbacks, __ATOMIC_RELAXED);
+	memset(&threadOptimistic, 0, sizeof(threadOptimistic));
+}
+
+/*reportOptimisticCounts prints the merged optimistic transaction counts and the abort and retry rates to stderr*/
+void reportOptimisticCounts(void){
+
+	OptimisticCounts *totals = &optimisticTotals;
+	double attempts = totals->transactions + totals->aborts;
+
+	fprintf(stderr, "optimistic transactions %lld read_only %lld aborts %lld retried %lld fallbacks %lld abort_rate %.4f retry_rate %.4f\n",
+		totals->transactions, totals->readOnly, totals->aborts, totals->retried, totals->fallbacks,
+		attempts > 0 ? totals->aborts/attempts : 0.0, totals->transactions > 0 ? (double)totals->retried/totals->transactions : 0.0);
+}
+
+/*runOptimisticTransaction runs a client transaction without locking. It reads the version words of the accounts it
+ * touches, copies their balances and checks the versions again, so the copies held together at one moment. The usual
+ * fee logic runs on the copies through accountRecord. To commit, the versions are moved from even to odd with compare
+ * and swap, which fails if any other thread changed or is changing an account since it was read. The new balances
+ * are then written and the versions made even again. A rejected transaction changes nothing, so it commits as soon as
+ * its reads are checked. After an abort it backs off and tries again, and after OPTIMISTIC_ATTEMPTS it takes the
+ * version words as locks. Returns the transaction's status*/
+int runOptimisticTransaction(Trans *transaction){
+
+	OptimisticSet set;
+	unsigned int version[2];
+	int accountCount;
+	int backoff = 1;
+	int attempt;
+	int status;
+	int i;
+	int j;
+
+	transactionAccounts(transaction, &set.accountNum[0], &set.accountNum[1]);
+	accountCount = set.accountNum[0] == set.accountNum[1] ? 1 : 2;
+	if(accountCount == 2 && set.accountNum[1] < set.accountNum[0]){	//versions are taken in ascending order
+		int swap = set.accountNum[0];
+		set.accountNum[0] = set.accountNum[1];
+		set.accountNum[1] = swap;
+	}
+	threadOptimistic.transactions++;
+
+	for(attempt = 0; attempt < OPTIMISTIC_ATTEMPTS; attempt++){
+		if(attempt > 0){			//back off after an abort
+			for(i = 0; i < backoff; i++){
+				__builtin_ia32_pause();
+			}
+			if(backoff < OPTIMISTIC_BACKOFF_MAX){
+				backoff *= 2;
+			}
+			else{
+				sched_yield();
+			}
+		}
+
+		/*read a consistent copy of every account*/
+		for(i = 0; i < accountCount; i++){
+			version[i] = __atomic_load_n(&accounts[set.accountNum[i] - 1].snapshotSequence, __ATOMIC_ACQUIRE);
+			set.record[i].balanceWord = __atomic_load_n(&accounts[set.accountNum[i] - 1].balanceWord, __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);	//the copies must be read before the versions are checked again
+		for(i = 0; i < accountCount; i++){
+			if((version[i] & 1) != 0 || __atomic_load_n(&accounts[set.accountNum[i] - 1].snapshotSequence, __ATOMIC_RELAXED) != version[i]){
+				break;
+			}
+		}
+		if(i < accountCount){
+			threadOptimistic.aborts++;
+			continue;
+		}
+
+		optimisticSet = &set;
+		status = applyTransaction(transaction);
+		optimisticSet = NULL;
+		if(status != TRANS_OK){
+			threadOptimistic.readOnly++;
+			threadOptimistic.retried += attempt > 0;
+			if(journaling){			//nothing changed, so the record holds no balance
+				journalOutcome(transaction, status, 0, 0, 0, 0);
+			}
+			return status;
+		}
+
+		/*validate and take the versions, giving back the ones taken if another is found changed*/
+		for(i = 0; i < accountCount; i++){
+			unsigned int expected = version[i];
+			if(!__atomic_compare_exchange_n(&accounts[set.accountNum[i] - 1].snapshotSequence, &expected, version[i] + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+				break;
+			}
+		}
+		if(i < accountCount){
+			for(j = 0; j < i; j++){		//nothing was written, so the version goes back to the one read
+				__atomic_store_n(&accounts[set.accountNum[j] - 1].snapshotSequence, version[j], __ATOMIC_RELEASE);
+			}
+			threadOptimistic.aborts++;
+			continue;
+		}
+
+		__atomic_thread_fence(__ATOMIC_RELEASE);	//the odd versions must be seen before any of the changes
+		for(i = 0; i < accountCount; i++){
+			__atomic_store_n(&accounts[set.accountNum[i] - 1].balanceWord, set.record[i].balanceWord, __ATOMIC_RELAXED);
+		}
+		if(journaling){				//the odd versions hold the accounts like their locks
+			journalTransaction(transaction, status);
+		}
+		for(i = 0; i < accountCount; i++){
+			__atomic_store_n(&accounts[set.accountNum[i] - 1].snapshotSequence, version[i] + 2, __ATOMIC_RELEASE);
+		}
+		threadOptimistic.retried += attempt > 0;
+		return TRANS_OK;
+	}
+
+	/*too many conflicts, take the accounts so the transaction cannot abort again*/
+	threadOptimistic.retried++;
+	threadOptimistic.fallbacks++;
+	lockAccounts(set.accountNum[0], set.accountNum[accountCount - 1]);
+	status = applyTransaction(transaction);
+	if(journaling){
+		journalTransaction(transaction, status);
+	}
+	unlockAccounts(set.accountNum[0], set.accountNum[accountCount - 1]);
+	return status;
+}
+
+/*buildAccountStore lays the accounts out for concurrent use: the mutable balances and locks go in a cache line
+ * aligned array with one line per account, and the read-only fee configuration goes in one packed block holding
+ * each field as its own array*/
+void buildAccountStore(AccSpec *specs, int accountCount){
+
+	int i;
+	size_t count = accountCount > 0 ? accountCount : 1;
+	char *block = malloc(6*sizeof(int)*count + 2*count);	//six int arrays followed by two byte arrays
+
+	accounts = aligned_alloc(CACHE_LINE, sizeof(Acc)*count);
+	accountConfig.depositFee = (int*)block;
+	accountConfig.withdrawFee = accountConfig.depositFee + count;
+	accountConfig.transferFee = accountConfig.withdrawFee + count;
+	accountConfig.transactionNum = accountConfig.transferFee + count;
+	accountConfig.additionalFee = accountConfig.transactionNum + count;
+	accountConfig.overdraftFee = accountConfig.additionalFee + count;
+	accountConfig.overdraft = (unsigned char*)(accountConfig.overdraftFee + count);
+	accountConfig.type = accountConfig.overdraft + count;
+
+	if(accounts == NULL || block == NULL){
+		fprintf(stderr, "Out of memory while loading input\n");
+		exit(1);
+	}
+
+	for(i = 0; i < accountCount; i++){
+		accounts[i].balance = 0;
+		accounts[i].numberOfAccTrans = 0;
+		accounts[i].feeFreeTickets = specs[i].transactionNum;
+		accounts[i].journalVersion = 0;
+		accounts[i].snapshotSequence = 0;
+		if (initBankLock(&accounts[i].accountLock) != 0){	//per-account mutex lock validation
+			printf("\n mutex init failed\n");
+			exit(1);
+		}
+		accountConfig.depositFee[i] = specs[i].depositFee;
+		accountConfig.withdrawFee[i] = specs[i].withdrawFee;
+		accountConfig.transferFee[i] = specs[i].transferFee;
+		accountConfig.transactionNum[i] = specs[i].transactionNum;
+		accountConfig.additionalFee[i] = specs[i].additionalFee;
+		accountConfig.overdraftFee[i] = specs[i].overdraftFee;
+		accountConfig.overdraft[i] = specs[i].overdraft;
+		accountConfig.type[i] = specs[i].type;
+	}
+}
+
+/*freeAccountStore destroys the account locks and releases the memory of the account store*/
+void freeAccountStore(int accountCount){
+
+	int i;
+	for(i = 0; i < accountCount; i++){
+		destroyBankLock(&accounts[i].accountLock);
+	}
+	free(accounts);
+	free(accountConfig.depositFee);		//start of the packed configuration block
+}
+
+/*skipSpaces moves the cursor past any blanks on the current line*/
+static inline const char *skipSpaces(const char *cursor, const char *end){
+	while(cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')){
+		cursor++;
+	}
+	return cursor;
+}
+
+/*skipWord moves the cursor past the current word and the blanks that follow it*/
+static inline const char *skipWord(const char *cursor, const char *end){
+	while(cursor < end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n'){
+		cursor++;
+	}
+	return skipSpaces(cursor, end);
+}
+
+/*parseNumber reads the next integer at the cursor, skipping a leading 'a' so account
+ * references such as a12 can be read directly, and advances the cursor past it*/
+static inline int parseNumber(const char **cursor, const char *end){
+	const char *p = skipSpaces(*cursor, end);
+	int negative = 0;
+	int value = 0;
+
+	if(p < end && *p == 'a'){		//account reference
+		p++;
+	}
+	if(p < end && *p == '-'){
+		negative = 1;
+		p++;
+	}
+	while(p < end && (unsigned)(*p - '0') < 10){
+		value = value*10 + (*p - '0');
+		p++;
+	}
+
+	*cursor = p;
+	return negative ? -value : value;
+}
+
+/*growArray doubles the capacity of a dynamically allocated array when it is full*/
+static void *growArray(void *array, int count, int *capacity, size_t elementSize){
+	if(count < *capacity){
+		return array;
+	}
+	*capacity = *capacity ? *capacity*2 : 64;
+	array = realloc(array, elementSize*(*capacity));
+	if(array == NULL){
+		fprintf(stderr, "Out of memory while loading input\n");
+		exit(1);
+	}
+	return array;
+}
+
+/*parseTransactions appends the transactions on a depositor or client line to the arena and
+ * returns how many were read; the cursor is left at the end of the line*/
+static int parseTransactions(const char **cursor, const char *end, int *arenaCount){
+	const char *p = *cursor;
+	int count = 0;
+	Trans obj;
+
+	while(p < end && *p != '\n'){
+		obj.transType = *p;
+		obj.takeAccountNum = 0;
+		obj.giveAccountNum = 0;
+		p = skipWord(p, end);
+
+		if(obj.transType == 'd'){			//deposit: d a<account> <amount>
+			obj.giveAccountNum = parseNumber(&p, end);
+		}
+		else if(obj.transType == 'w'){			//withdraw: w a<account> <amount>
+			obj.takeAccountNum = parseNumber(&p, end);
+		}
+		else if(obj.transType == 't'){			//transfer: t a<from> a<to> <amount>
+			obj.takeAccountNum = parseNumber(&p, end);
+			obj.giveAccountNum = parseNumber(&p, end);
+		}
+		else{						//not a transaction, move onto the next word
+			continue;
+		}
+		obj.amount = parseNumber(&p, end);
+		p = skipSpaces(p, end);
+
+		transArena[(*arenaCount)++] = obj;
+		count++;
+	}
+
+	*cursor = p;
+	return count;
+}
+
+/*parseAccount reads the characteristics of the account on the current line*/
+static void parseAccount(const char **cursor, const char *end, AccSpec *obj){
+	const char *p = skipWord(*cursor, end);		//skip the account name
+
+	obj->type = ACCOUNT_PERSONAL;
+	obj->depositFee = 0;
+	obj->withdrawFee = 0;
+	obj->transferFee = 0;
+	obj->transactionNum = 0;
+	obj->additionalFee = 0;
+	obj->overdraftFee = 0;
+	obj->overdraft = 0;
+
+	while(p < end && *p != '\n'){
+		const char *word = p;
+		p = skipWord(p, end);
+
+		if(*word == 'b' && (p - word) > 1 && word[1] == 'u'){		//account type
+			obj->type = ACCOUNT_BUSINESS;
+		}
+		else if(*word == 'd' && (word + 1 == end || word[1] == ' ')){	//deposit fee
+			obj->depositFee = parseNumber(&p, end);
+		}
+		else if(*word == 'w' && (word + 1 == end || word[1] == ' ')){	//withdraw fee
+			obj->withdrawFee = parseNumber(&p, end);
+		}
+		else if(*word == 't' && (word + 1 == end || word[1] == ' ')){	//transfer fee
+			obj->transferFee = parseNumber(&p, end);
+		}
+		else if(*word == 't' && word[1] == 'r'){			//additional fee limit and the additional fee
+			obj->transactionNum = parseNumber(&p, end);
+			obj->additionalFee = parseNumber(&p, end);
+		}
+		else if(*word == 'Y'){						//overdraft exists along with its fee
+			obj->overdraft = 1;
+			obj->overdraftFee = parseNumber(&p, end);
+		}
+		p = skipSpaces(p, end);
+	}
+
+	*cursor = p;
+}
+
+/*loadInput maps the input file into memory once and tokenizes it in a single pass, filling the global
+ * accounts array along with the depositors and clients arrays. The account store is built as soon as the
+ * account lines end, and if lineParsed is given it is called with every depositor and client line as soon
+ * as the line is parsed. Returns 0 on success*/
+int loadInput(char *filename, int *accountCount, Depo **depositors, int *depositorCount, Cli **clients, int *clientCount, void (*lineParsed)(Task *line, int accountCount)){
+
+	struct timespec start, finish;
+	struct stat info;
+	int fd;
+	char *data = NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0 || fstat(fd, &info) != 0){				//check to see if input file was unable to open
+		printf("File %s could not be opened", filename);
+		return 1;
+	}
+
+	if(info.st_size > 0){
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED){
+			printf("File %s could not be opened", filename);
+			close(fd);
+			return 1;
+		}
+		madvise(data, info.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	/*every transaction takes at least two characters of the file (its type and a separator), so reserving room for
+	 * half the file size in transactions means the arena never has to move; pages are only used once written to*/
+	transArenaSize = sizeof(Trans)*(info.st_size/2 + 1);
+	transArena = mmap(NULL, transArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(transArena == MAP_FAILED){
+		fprintf(stderr, "Out of memory while loading input\n");
+		exit(1);
+	}
+
+	const char *p = data;
+	const char *end = data + info.st_size;
+	int accountCapacity = 0;
+	int depositorCapacity = 0;
+	int clientCapacity = 0;
+	int arenaCount = 0;
+	int storeBuilt = 0;		//1 once the account lines are done and the account store is built
+	AccSpec *specs = NULL;		//characteristics of the accounts read so far
+	Task line;			//depositor or client line handed to lineParsed
+
+	*depositors = NULL;
+	*clients = NULL;
+	*accountCount = *depositorCount = *clientCount = 0;
+
+	/*loop through every line of the input file and extract it based on its first characters*/
+	while(p < end){
+		p = skipSpaces(p, end);
+
+		if(p < end && *p == 'a'){					//account line
+			AccSpec obj;
+			parseAccount(&p, end, &obj);
+
+			specs = growArray(specs, *accountCount, &accountCapacity, sizeof(AccSpec));
+			specs[(*accountCount)++] = obj;
+		}
+		else if(p < end && *p != '\n' && !storeBuilt){			//account lines are done
+			buildAccountStore(specs, *accountCount);
+			storeBuilt = 1;
+			continue;
+		}
+		else if(p + 1 < end && p[0] == 'd' && p[1] == 'e'){		//depositor line
+			Depo obj;
+			p = skipWord(p, end);
+			obj.depositorNum = *depositorCount + 1;
+			obj.transactions = transArena + arenaCount;	//the depositor's slice of the arena
+			obj.numOfTrans = parseTransactions(&p, end, &arenaCount);
+
+			*depositors = growArray(*depositors, *depositorCount, &depositorCapacity, sizeof(Depo));
+			(*depositors)[(*depositorCount)++] = obj;
+
+			if(lineParsed != NULL){
+				line.transactions = obj.transactions;
+				line.numOfTrans = obj.numOfTrans;
+				line.next = 0;
+				line.isDepositor = 1;
+				lineParsed(&line, *accountCount);
+			}
+		}
+		else if(p < end && *p == 'c'){					//client line
+			Cli obj;
+			p = skipWord(p, end);
+			obj.clientNum = *clientCount + 1;
+			obj.transactions = transArena + arenaCount;	//the client's slice of the arena
+			obj.numOfTrans = parseTransactions(&p, end, &arenaCount);
+
+			*clients = growArray(*clients, *clientCount, &clientCapacity, sizeof(Cli));
+			(*clients)[(*clientCount)++] = obj;
+
+			if(lineParsed != NULL){
+				line.transactions = obj.transactions;
+				line.numOfTrans = obj.numOfTrans;
+				line.next = 0;
+				line.isDepositor = 0;
+				lineParsed(&line, *accountCount);
+			}
+		}
+
+		while(p < end && *p != '\n'){					//move onto the next line
+			p++;
+		}
+		p++;
+	}
+
+	if(!storeBuilt){			//the file only had account lines
+		buildAccountStore(specs, *accountCount);
+	}
+	free(specs);
+	if(data != NULL){
+		munmap(data, info.st_size);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+
+	double seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1e9;
+	double megabytes = info.st_size/(1024.0*1024.0);
+	fprintf(stderr, "parsed %.1f MB in %.3f s (%.1f MB/s)\n", megabytes, seconds, seconds > 0 ? megabytes/seconds : 0.0);
+
+	return 0;
+}
+
+/*alignImageOffset rounds a file offset in a compiled image up to the next cache line boundary*/
+static uint64_t alignImageOffset(uint64_t offset){
+	return (offset + CACHE_LINE - 1) & ~(uint64_t)(CACHE_LINE - 1);
+}
+
+/*padImage writes zeros to the image until the file reaches offset*/
+static void padImage(FILE *image_fp, uint64_t offset){
+	while((uint64_t)ftell(image_fp) < offset){
+		fputc(0, image_fp);
+	}
+}
+
+/*imageSectionFits checks that count records of elementSize bytes starting at offset lie inside an image of imageSize bytes*/
+static int imageSectionFits(uint64_t offset, uint64_t count, size_t elementSize, size_t imageSize){
+	return offset <= imageSize && count <= (imageSize - offset)/elementSize;
+}
+
+/*compileInput parses the text input file once and writes it to imagename as a compiled image, which loadImage
+ * can later run from without parsing. Returns 0 on success*/
+int compileInput(char *filename, char *imagename){
+
+	int accountCount;
+	int depositorCount;
+	int clientCount;
+	Depo *depositors;
+	Cli *clients;
+	ImageHeader header;
+	ImageAccount account;
+	ImageLine line;
+	uint64_t transCount = 0;
+	int i;
+
+	if(loadInput(filename, &accountCount, &depositors, &depositorCount, &clients, &clientCount, NULL) != 0){
+		return 1;
+	}
+
+	/*the lines are slices of the arena, so the arena holds every transaction up to the end of the last slice*/
+	for(i = 0; i < depositorCount; i++){
+		if((uint64_t)(depositors[i].transactions - transArena) + depositors[i].numOfTrans > transCount){
+			transCount = (depositors[i].transactions - transArena) + depositors[i].numOfTrans;
+		}
+	}
+	for(i = 0; i < clientCount; i++){
+		if((uint64_t)(clients[i].transactions - transArena) + clients[i].numOfTrans > transCount){
+			transCount = (clients[i].transactions - transArena) + clients[i].numOfTrans;
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	header.version = IMAGE_VERSION;
+	header.accountCount = accountCount;
+	header.depositorCount = depositorCount;
+	header.clientCount = clientCount;
+	header.transCount = transCount;
+	header.accountOffset = alignImageOffset(sizeof(ImageHeader));
+	header.lineOffset = alignImageOffset(header.accountOffset + sizeof(ImageAccount)*(uint64_t)accountCount);
+	header.transOffset = alignImageOffset(header.lineOffset + sizeof(ImageLine)*(uint64_t)(depositorCount + clientCount));
+
+	FILE *image_fp = fopen(imagename, "wb");
+	if(image_fp == NULL){
+		printf("File %s could not be opened", imagename);
+		return 1;
+	}
+
+	fwrite(&header, sizeof(header), 1, image_fp);
+
+	padImage(image_fp, header.accountOffset);
+	memset(&account, 0, sizeof(account));
+	for(i = 0; i < accountCount; i++){
+		account.depositFee = accountConfig.depositFee[i];
+		account.withdrawFee = accountConfig.withdrawFee[i];
+		account.transferFee = accountConfig.transferFee[i];
+		account.transactionNum = accountConfig.transactionNum[i];
+		account.additionalFee = accountConfig.additionalFee[i];
+		account.overdraftFee = accountConfig.overdraftFee[i];
+		account.type = accountConfig.type[i];
+		account.overdraft = accountConfig.overdraft[i];
+		fwrite(&account, sizeof(account), 1, image_fp);
+	}
+
+	padImage(image_fp, header.lineOffset);
+	memset(&line, 0, sizeof(line));
+	for(i = 0; i < depositorCount; i++){
+		line.firstTrans = depositors[i].transactions - transArena;
+		line.numOfTrans = depositors[i].numOfTrans;
+		fwrite(&line, sizeof(line), 1, image_fp);
+	}
+	for(i = 0; i < clientCount; i++){
+		line.firstTrans = clients[i].transactions - transArena;
+		line.numOfTrans = clients[i].numOfTrans;
+		fwrite(&line, sizeof(line), 1, image_fp);
+	}
+
+	padImage(image_fp, header.transOffset);
+	fwrite(transArena, sizeof(Trans), transCount, image_fp);
+
+	int failed = ferror(image_fp);
+	if(fclose(image_fp) != 0 || failed){
+		fprintf(stderr, "Could not write image %s\n", imagename);
+		failed = 1;
+	}
+	else{
+		fprintf(stderr, "compiled %d accounts, %d depositors, %d clients and %llu transactions into %s\n",
+			accountCount, depositorCount, clientCount, (unsigned long long)transCount, imagename);
+	}
+
+	munmap(transArena, transArenaSize);
+	freeAccountStore(accountCount);
+	free(depositors);
+	free(clients);
+
+	return failed;
+}
+
+/*loadImage maps a compiled image written by compileInput and runs from it in place: the account store is built
+ * from the account table and the depositors and clients point straight at the transactions in the mapping, so
+ * nothing is parsed or copied. lineParsed is called with every depositor and client line the same way loadInput
+ * does. Returns 0 on success*/
+int loadImage(char *imagename, int *accountCount, Depo **depositors, int *depositorCount, Cli **clients, int *clientCount, void (*lineParsed)(Task *line, int accountCount)){
+
+	struct timespec start, finish;
+	struct stat info;
+	int fd;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	fd = open(imagename, O_RDONLY);
+	if(fd < 0 || fstat(fd, &info) != 0){				//check to see if the image was unable to open
+		printf("File %s could not be opened", imagename);
+		return 1;
+	}
+
+	inputImageSize = info.st_size;
+	inputImage = inputImageSize >= sizeof(ImageHeader) ? mmap(NULL, inputImageSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(inputImage == MAP_FAILED){
+		inputImage = NULL;
+		fprintf(stderr, "File %s is not a compiled image\n", imagename);
+		return 1;
+	}
+
+	/*check the header before trusting any of the offsets in it*/
+	ImageHeader *header = (ImageHeader*)inputImage;
+	uint64_t lineCount = (uint64_t)header->depositorCount + header->clientCount;
+
+	if(memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 || header->version != IMAGE_VERSION
+		|| header->accountCount > INT32_MAX || header->depositorCount > INT32_MAX || header->clientCount > INT32_MAX
+		|| !imageSectionFits(header->accountOffset, header->accountCount, sizeof(ImageAccount), inputImageSize)
+		|| !imageSectionFits(header->lineOffset, lineCount, sizeof(ImageLine), inputImageSize)
+		|| !imageSectionFits(header->transOffset, header->transCount, sizeof(Trans), inputImageSize)){
+		fprintf(stderr, "File %s is not a compiled image of version %d\n", imagename, IMAGE_VERSION);
+		munmap(inputImage, inputImageSize);
+		inputImage = NULL;
+		return 1;
+	}
+
+	ImageAccount *imageAccounts = (ImageAccount*)(inputImage + header->accountOffset);
+	ImageLine *lines = (ImageLine*)(inputImage + header->lineOffset);
+	uint64_t lineNum;
+
+	for(lineNum = 0; lineNum < lineCount; lineNum++){
+		if(lines[lineNum].numOfTrans > header->transCount || lines[lineNum].firstTrans > header->transCount - lines[lineNum].numOfTrans){
+			fprintf(stderr, "File %s is not a compiled image of version %d\n", imagename, IMAGE_VERSION);
+			munmap(inputImage, inputImageSize);
+			inputImage = NULL;
+			return 1;
+		}
+	}
+
+	transArena = (Trans*)(inputImage + header->transOffset);
+	madvise(transArena, sizeof(Trans)*header->transCount, MADV_SEQUENTIAL);
+
+	*accountCount = header->accountCount;
+	*depositorCount = header->depositorCount;
+	*clientCount = header->clientCount;
+
+	AccSpec *specs = malloc(sizeof(AccSpec)*(*accountCount > 0 ? *accountCount : 1));
+	*depositors = malloc(sizeof(Depo)*(*depositorCount > 0 ? *depositorCount : 1));
+	*clients = malloc(sizeof(Cli)*(*clientCount > 0 ? *clientCount : 1));
+	if(specs == NULL || *depositors == NULL || *clients == NULL){
+		fprintf(stderr, "Out of memory while loading input\n");
+		exit(1);
+	}
+
+	for(i = 0; i < *accountCount; i++){
+		specs[i].type = imageAccounts[i].type;
+		specs[i].overdraft = imageAccounts[i].overdraft;
+		specs[i].depositFee = imageAccounts[i].depositFee;
+		specs[i].withdrawFee = imageAccounts[i].withdrawFee;
+		specs[i].transferFee = imageAccounts[i].transferFee;
+		specs[i].transactionNum = imageAccounts[i].transactionNum;
+		specs[i].additionalFee = imageAccounts[i].additionalFee;
+		specs[i].overdraftFee = imageAccounts[i].overdraftFee;
+	}
+	buildAccountStore(specs, *accountCount);
+	free(specs);
+
+	/*depositor lines come first in the line table, followed by the client lines*/
+	Task line;
+	for(i = 0; i < *depositorCount; i++){
+		(*depositors)[i].depositorNum = i + 1;
+		(*depositors)[i].transactions = transArena + lines[i].firstTrans;
+		(*depositors)[i].numOfTrans = lines[i].numOfTrans;
+
+		if(lineParsed != NULL){
+			line.transactions = (*depositors)[i].transactions;
+			line.numOfTrans = (*depositors)[i].numOfTrans;
+			line.next = 0;
+			line.isDepositor = 1;
+			lineParsed(&line, *accountCount);
+		}
+	}
+	for(i = 0; i < *clientCount; i++){
+		(*clients)[i].clientNum = i + 1;
+		(*clients)[i].transactions = transArena + lines[*depositorCount + i].firstTrans;
+		(*clients)[i].numOfTrans = lines[*depositorCount + i].numOfTrans;
+
+		if(lineParsed != NULL){
+			line.transactions = (*clients)[i].transactions;
+			line.numOfTrans = (*clients)[i].numOfTrans;
+			line.next = 0;
+			line.isDepositor = 0;
+			lineParsed(&line, *accountCount);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+
+	double seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1e9;
+	fprintf(stderr, "mapped %.1f MB image in %.3f s\n", inputImageSize/(1024.0*1024.0), seconds);
+
+	return 0;
+}
+
+#define STEAL_SLICE 256		//number of transactions a worker runs from a task before the rest of it can be stolen
+
+Deque *deques;			//one deque of tasks per worker in the work-stealing pool
+int workerCount;		//number of workers in the work-stealing pool
+int remainingTasks;		//number of tasks that have not run all of their transactions yet
+
+/*pushTask adds a task to the owner end of a deque, growing the deque if it is full*/
+static void pushTask(Deque *deque, Task *task){
+	pthread_mutex_lock(&deque->dequeLock);
+	if(deque->tail == deque->capacity){
+		deque->tasks = growArray(deque->tasks, deque->tail - deque->head, &deque->capacity, sizeof(Task*));
+		if(deque->head > 0){		//slide the remaining tasks back to the start of the array
+			memmove(deque->tasks, deque->tasks + deque->head, sizeof(Task*)*(deque->tail - deque->head));
+			deque->tail -= deque->head;
+			deque->head = 0;
+		}
+	}
+	deque->tasks[deque->tail++] = task;
+	pthread_mutex_unlock(&deque->dequeLock);
+}
+
+/*popTask removes the newest task from the owner end of a deque, or returns NULL if it is empty*/
+static Task *popTask(Deque *deque){
+	Task *task = NULL;
+	pthread_mutex_lock(&deque->dequeLock);
+	if(deque->head < deque->tail){
+		task = deque->tasks[--deque->tail];
+	}
+	pthread_mutex_unlock(&deque->dequeLock);
+	return task;
+}
+
+/*stealTask removes the oldest task from the thief end of a deque, or returns NULL if it is empty*/
+static Task *stealTask(Deque *deque){
+	Task *task = NULL;
+	pthread_mutex_lock(&deque->dequeLock);
+	if(deque->head < deque->tail){
+		task = deque->tasks[deque->head++];
+	}
+	pthread_mutex_unlock(&deque->dequeLock);
+	return task;
+}
+
+/*thread routine for a worker in the work-stealing pool. A worker runs a slice of a task and then puts the
+ * task back on its own deque, so a long client is picked up again later while idle workers steal the rest*/
+void *stealWorker(void *worker){
+
+	int self = (int)(intptr_t)worker;
+	int i;
+
+	while(__atomic_load_n(&remainingTasks, __ATOMIC_ACQUIRE) > 0){
+		Task *task = popTask(&deques[self]);
+
+		for(i = 1; task == NULL && i < workerCount; i++){	//own deque is empty so try to steal from the others
+			task = stealTask(&deques[(self + i) % workerCount]);
+		}
+
+		if(task == NULL){		//every task is currently held by another worker
+			sched_yield();
+			continue;
+		}
+
+		int last = task->next + STEAL_SLICE;
+		if(last > task->numOfTrans){
+			last = task->numOfTrans;
+		}
+
+		if(task->isDepositor){
+			runDepositBatch(&task->transactions[task->next], last - task->next);
+			task->next = last;
+		}
+		for(; task->next < last; task->next++){
+			runClientTransaction(&task->transactions[task->next]);
+		}
+
+		flushLocalCounters();
+		if(task->next < task->numOfTrans){
+			pushTask(&deques[self], task);
+		}
+		else{
+			__atomic_sub_fetch(&remainingTasks, 1, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+/*runWorkStealing runs every task on a pool with one worker per core and returns once all of them are done*/
+void runWorkStealing(Task *tasks, int taskCount){
+
+	int i;
+
+	workerCount = poolSize();
+	if(workerCount > taskCount){		//no point in having more workers than tasks
+		workerCount = taskCount;
+	}
+	if(workerCount < 1){
+		return;
+	}
+
+	deques = malloc(sizeof(Deque)*workerCount);
+	pthread_t *workers = malloc(sizeof(pthread_t)*workerCount);
+
+	for(i = 0; i < workerCount; i++){
+		pthread_mutex_init(&deques[i].dequeLock, NULL);
+		deques[i].tasks = NULL;
+		deques[i].head = 0;
+		deques[i].tail = 0;
+		deques[i].capacity = 0;
+	}
+
+	for(i = 0; i < taskCount; i++){		//deal the tasks out to the workers evenly
+		pushTask(&deques[i % workerCount], &tasks[i]);
+	}
+	remainingTasks = taskCount;
+
+	for(i = 0; i < workerCount; i++){
+		if(pthread_create(&workers[i], NULL, &stealWorker, (void*)(intptr_t)i) != 0){
+			printf("\n Error creating thread %d", i);
+		}
+		pinThread(workers[i], i);
+	}
+
+	for(i = 0; i < workerCount; i++){
+		pthread_join(workers[i], NULL);
+	}
+
+	for(i = 0; i < workerCount; i++){
+		pthread_mutex_destroy(&deques[i].dequeLock);
+		free(deques[i].tasks);
+	}
+	free(deques);
+	free(workers);
+}
+
+#define BATCH_CHUNK 64		//number of transactions a worker claims at a time from the current batch
+
+//plan for the batch engine: every transaction is placed in a batch where no two transactions share an account
+typedef struct batchPlan{
+	Trans **order;			//transactions grouped by batch
+	int *batchStart;		//index in order where each batch starts, with one extra entry marking the end
+	int *batchNext;			//index in order of the next unclaimed transaction of each batch
+	int batchCount;			//number of batches
+	pthread_barrier_t barrier;	//workers wait here between batches
+} BatchPlan;
+
+/*thread routine for a worker of the batch engine. Transactions inside a batch touch disjoint accounts so
+ * they are applied without any locks, and all workers finish a batch before any of them starts the next*/
+void *batchWorker(void *plan){
+
+	BatchPlan *batchPlan = (BatchPlan*)plan;
+	int batch;
+	int i;
+
+	for(batch = 0; batch < batchPlan->batchCount; batch++){
+		int batchEnd = batchPlan->batchStart[batch + 1];
+
+		while(1){
+			int first = __atomic_fetch_add(&batchPlan->batchNext[batch], BATCH_CHUNK, __ATOMIC_RELAXED);
+			if(first >= batchEnd){
+				break;
+			}
+
+			int last = first + BATCH_CHUNK < batchEnd ? first + BATCH_CHUNK : batchEnd;
+			for(i = first; i < last; i++){
+				long long start = benchmark ? nowNanoseconds() : 0;
+				int accountNum1;
+				int accountNum2;
+
+				transactionAccounts(batchPlan->order[i], &accountNum1, &accountNum2);
+				if(queryReaders){
+					beginAccountWrite(accountNum1, accountNum2);
+				}
+				int status = applyTransaction(batchPlan->order[i]);
+				if(journaling){
+					journalTransaction(batchPlan->order[i], status);
+				}
+				if(queryReaders){
+					endAccountWrite(accountNum1, accountNum2);
+				}
+				if(benchmark){
+					recordLatency(start);
+				}
+			}
+		}
+
+		flushLocalCounters();
+		pthread_barrier_wait(&batchPlan->barrier);
+	}
+	return NULL;
+}
+
+/*runBatches builds the conflict graph of the tasks' transactions and runs it batch by batch on one worker per core.
+ * Transactions are visited round robin by task (first transaction of every task, then the second, and so on) and each
+ * one is placed in the batch after the latest batch holding an earlier transaction on the same account or of the same
+ * task. This keeps the program order of every depositor and client, and within a batch no two transactions conflict.
+ * Any two transactions on the same account run in visiting order, so the balances are exactly those of running every
+ * transaction one at a time in the round robin order, whatever the number of workers: this is the deterministic mode
+ * whose output is used as the golden output for verifyBalances*/
+void runBatches(Task *tasks, int taskCount, int accountCount){
+
+	int transactionCount = 0;
+	int i;
+
+	for(i = 0; i < taskCount; i++){
+		transactionCount += tasks[i].numOfTrans;
+	}
+	if(transactionCount == 0){
+		return;
+	}
+
+	int *accountBatch = calloc(accountCount + 1, sizeof(int));	//one past the latest batch that touches each account
+	int *taskBatch = calloc(taskCount, sizeof(int));		//one past the batch of each task's latest transaction
+	int *batchOf = malloc(sizeof(int)*transactionCount);		//batch of every transaction in visiting order
+	Trans **visited = malloc(sizeof(Trans*)*transactionCount);	//transactions in visiting order
+	int *active = malloc(sizeof(int)*taskCount);			//tasks that still have transactions left to visit
+	int activeCount = 0;
+	int batchCount = 0;
+	int visitedCount = 0;
+	int round;
+
+	for(i = 0; i < taskCount; i++){
+		if(tasks[i].numOfTrans > 0){
+			active[activeCount++] = i;
+		}
+	}
+
+	/*assign every transaction to a batch, visiting the tasks round robin*/
+	for(round = 0; activeCount > 0; round++){
+		int kept = 0;
+
+		for(i = 0; i < activeCount; i++){
+			int taskIndex = active[i];
+			Trans *transaction = &tasks[taskIndex].transactions[round];
+			int accountNum1;
+			int accountNum2;
+
+			transactionAccounts(transaction, &accountNum1, &accountNum2);
+
+			int batch = taskBatch[taskIndex];
+			if(accountBatch[accountNum1] > batch){
+				batch = accountBatch[accountNum1];
+			}
+			if(accountBatch[accountNum2] > batch){
+				batch = accountBatch[accountNum2];
+			}
+
+			accountBatch[accountNum1] = accountBatch[accountNum2] = taskBatch[taskIndex] = batch + 1;
+			if(batch + 1 > batchCount){
+				batchCount = batch + 1;
+			}
+
+			visited[visitedCount] = transaction;
+			batchOf[visitedCount++] = batch;
+
+			if(round + 1 < tasks[taskIndex].numOfTrans){	//keep the task for the next round
+				active[kept++] = taskIndex;
+			}
+		}
+		activeCount = kept;
+	}
+
+	/*group the transactions by batch with a counting sort, which keeps the visiting order inside each batch*/
+	BatchPlan plan;
+	plan.batchCount = batchCount;
+	plan.batchStart = calloc(batchCount + 1, sizeof(int));
+	plan.batchNext = malloc(sizeof(int)*(batchCount + 1));
+	plan.order = malloc(sizeof(Trans*)*transactionCount);
+
+	for(i = 0; i < transactionCount; i++){
+		plan.batchStart[batchOf[i] + 1]++;
+	}
+	for(i = 0; i < batchCount; i++){
+		plan.batchStart[i + 1] += plan.batchStart[i];
+	}
+	memcpy(plan.batchNext, plan.batchStart, sizeof(int)*(batchCount + 1));
+	for(i = 0; i < transactionCount; i++){
+		plan.order[plan.batchNext[batchOf[i]]++] = visited[i];
+	}
+	memcpy(plan.batchNext, plan.batchStart, sizeof(int)*(batchCount + 1));
+
+	free(accountBatch);
+	free(taskBatch);
+	free(batchOf);
+	free(visited);
+	free(active);
+
+	/*run the batches on one worker per core*/
+	int batchWorkers = poolSize();
+	pthread_t *workers = malloc(sizeof(pthread_t)*batchWorkers);
+	pthread_barrier_init(&plan.barrier, NULL, batchWorkers);
+
+	for(i = 0; i < batchWorkers; i++){
+		if(pthread_create(&workers[i], NULL, &batchWorker, &plan) != 0){
+			printf("\n Error creating thread %d", i);
+		}
+		pinThread(workers[i], i);
+	}
+	for(i = 0; i < batchWorkers; i++){
+		pthread_join(workers[i], NULL);
+	}
+
+	pthread_barrier_destroy(&plan.barrier);
+	free(workers);
+	free(plan.order);
+	free(plan.batchStart);
+	free(plan.batchNext);
+}
+
+/*poolSize returns the number of workers the pooled engines use, one per core unless set on the command line*/
+int poolSize(void){
+
+	if(poolWorkers > 0){
+		return poolWorkers;
+	}
+
+	int cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? cores : 1;
+}
+
+/*pinThread pins the worker with the given index to a CPU when pinning is on. Workers go round robin over the CPUs
+ * the program was allowed to run on when it started, so an affinity set by taskset is kept*/
+void pinThread(pthread_t thread, int index){
+
+	static cpu_set_t allowed;	//CPUs the program may run on
+	static int allowedCount = -1;	//number of CPUs in allowed, read the first time a worker is pinned
+	int cpu;
+
+	if(!pinWorkers){
+		return;
+	}
+	if(allowedCount < 0){
+		if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+			CPU_ZERO(&allowed);
+			CPU_SET(0, &allowed);
+		}
+		allowedCount = CPU_COUNT(&allowed);
+	}
+
+	index %= allowedCount;
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++){	//find the CPU for the index among the allowed ones
+		if(CPU_ISSET(cpu, &allowed) && index-- == 0){
+			break;
+		}
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(pthread_setaffinity_np(thread, sizeof(set), &set) != 0){
+		fprintf(stderr, "Could not pin thread to CPU %d\n", cpu);
+	}
+}
+
+/*nowNanoseconds returns the monotonic clock in nanoseconds*/
+long long nowNanoseconds(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000LL + now.tv_nsec;
+}
+
+//per thread buffer of transaction latencies recorded for the benchmark harness
+typedef struct latencyBuffer{
+	unsigned int *latencies;	//dynamically allocated array of latencies in nanoseconds
+	int count;			//number of latencies recorded
+	int capacity;			//size of the latencies array
+	struct latencyBuffer *next;	//next buffer in the list of every thread's buffer
+} LatencyBuffer;
+
+__thread LatencyBuffer *threadLatencies;	//latency buffer of the calling thread
+LatencyBuffer *allLatencies;			//list of every thread's latency buffer
+pthread_mutex_t latencyListLock = PTHREAD_MUTEX_INITIALIZER;	//lock protecting the list of buffers
+
+/*recordLatency records the time since start as the latency of one transaction in the calling thread's buffer*/
+void recordLatency(long long start){
+
+	LatencyBuffer *buffer = threadLatencies;
+	long long latency = nowNanoseconds() - start;
+
+	if(buffer == NULL){		//first transaction on this thread so add its buffer to the list
+		buffer = calloc(1, sizeof(LatencyBuffer));
+		pthread_mutex_lock(&latencyListLock);
+		buffer->next = allLatencies;
+		allLatencies = buffer;
+		pthread_mutex_unlock(&latencyListLock);
+		threadLatencies = buffer;
+	}
+
+	buffer->latencies = growArray(buffer->latencies, buffer->count, &buffer->capacity, sizeof(unsigned int));
+	buffer->latencies[buffer->count++] = latency < 0xffffffffLL ? (unsigned int)latency : 0xffffffffu;
+}
+
+static int compareLatencies(const void *a, const void *b){
+	unsigned int x = *(const unsigned int*)a;
+	unsigned int y = *(const unsigned int*)b;
+	return (x > y) - (x < y);
+}
+
+/*reportLatencies merges every thread's latencies and prints the throughput and latency percentiles to stderr
+ * in the form the benchmark harness reads*/
+void reportLatencies(long long elapsed){
+
+	LatencyBuffer *buffer;
+	long long count = 0;
+
+	for(buffer = allLatencies; buffer != NULL; buffer = buffer->next){
+		count += buffer->count;
+	}
+
+	unsigned int *merged = malloc(sizeof(unsigned int)*(count > 0 ? count : 1));
+	count = 0;
+	while(allLatencies != NULL){
+		buffer = allLatencies;
+		memcpy(merged + count, buffer->latencies, sizeof(unsigned int)*buffer->count);
+		count += buffer->count;
+		allLatencies = buffer->next;
+		free(buffer->latencies);
+		free(buffer);
+	}
+	qsort(merged, count, sizeof(unsigned int), compareLatencies);
+
+	double seconds = elapsed/1e9;
+	fprintf(stderr, "bench transactions %lld seconds %.6f tps %.0f p50_ns %u p99_ns %u\n", count, seconds,
+		seconds > 0 ? count/seconds : 0.0, count > 0 ? merged[count/2] : 0, count > 0 ? merged[(count*99)/100] : 0);
+	free(merged);
+}
+
+#ifdef LOCK_STATS
+
+#define HOT_ACCOUNTS 10		//number of hottest accounts listed in the contention report
+
+//per thread lock statistics, only compiled in when LOCK_STATS is defined
+typedef struct lockStats{
+	long long acquires;		//number of critical regions entered
+	long long waitTotal;		//total nanoseconds spent waiting to acquire locks
+	long long waitMax;		//longest single wait
+	long long holdTotal;		//total nanoseconds spent inside critical regions
+	long long holdMax;		//longest single critical region
+	long long holdStart;		//time the current critical region was entered
+	int *hitAccounts;		//open addressing table of the account numbers this thread locked
+	long long *hitCounts;		//number of times each account in hitAccounts was locked
+	int hitCapacity;		//size of the table, always a power of two
+	int hitUsed;			//number of accounts in the table
+	struct lockStats *next;		//next entry in the list of every thread's statistics
+} LockStats;
+
+__thread LockStats *threadLockStats;	//lock statistics of the calling thread
+LockStats *allLockStats;		//list of every thread's lock statistics
+pthread_mutex_t lockStatsListLock = PTHREAD_MUTEX_INITIALIZER;	//lock protecting the list of statistics
+
+/*countAccountHit adds one to the number of times the thread locked the account*/
+static void countAccountHit(LockStats *stats, int accountNum){
+
+	int i;
+
+	if(2*(stats->hitUsed + 1) > stats->hitCapacity){	//keep the table at most half full
+		int oldCapacity = stats->hitCapacity;
+		int *oldAccounts = stats->hitAccounts;
+		long long *oldCounts = stats->hitCounts;
+
+		stats->hitCapacity = oldCapacity ? oldCapacity*2 : 64;
+		stats->hitAccounts = calloc(stats->hitCapacity, sizeof(int));
+		stats->hitCounts = calloc(stats->hitCapacity, sizeof(long long));
+		stats->hitUsed = 0;
+
+		for(i = 0; i < oldCapacity; i++){
+			if(oldAccounts[i] != 0){
+				int slot = oldAccounts[i] & (stats->hitCapacity - 1);
+				while(stats->hitAccounts[slot] != 0){
+					slot = (slot + 1) & (stats->hitCapacity - 1);
+				}
+				stats->hitAccounts[slot] = oldAccounts[i];
+				stats->hitCounts[slot] = oldCounts[i];
+				stats->hitUsed++;
+			}
+		}
+		free(oldAccounts);
+		free(oldCounts);
+	}
+
+	int slot = accountNum & (stats->hitCapacity - 1);
+	while(stats->hitAccounts[slot] != 0 && stats->hitAccounts[slot] != accountNum){
+		slot = (slot + 1) & (stats->hitCapacity - 1);
+	}
+	if(stats->hitAccounts[slot] == 0){
+		stats->hitAccounts[slot] = accountNum;
+		stats->hitUsed++;
+	}
+	stats->hitCounts[slot]++;
+}
+
+/*recordLockAcquired records the wait for a critical region that was just entered on the accounts*/
+void recordLockAcquired(int accountNum1, int accountNum2, long long waitStart){
+
+	LockStats *stats = threadLockStats;
+	long long now = nowNanoseconds();
+
+	if(stats == NULL){		//first critical region on this thread so add its statistics to the list
+		stats = calloc(1, sizeof(LockStats));
+		pthread_mutex_lock(&lockStatsListLock);
+		stats->next = allLockStats;
+		allLockStats = stats;
+		pthread_mutex_unlock(&lockStatsListLock);
+		threadLockStats = stats;
+	}
+
+	stats->acquires++;
+	stats->waitTotal += now - waitStart;
+	if(now - waitStart > stats->waitMax){
+		stats->waitMax = now - waitStart;
+	}
+	stats->holdStart = now;
+
+	countAccountHit(stats, accountNum1);
+	if(accountNum2 != accountNum1){
+		countAccountHit(stats, accountNum2);
+	}
+}
+
+/*recordLockReleased records the hold time of the critical region that is about to be exited*/
+void recordLockReleased(void){
+
+	LockStats *stats = threadLockStats;
+	long long hold = nowNanoseconds() - stats->holdStart;
+
+	stats->holdTotal += hold;
+	if(hold > stats->holdMax){
+		stats->holdMax = hold;
+	}
+}
+
+/*writeContentionReport merges every thread's lock statistics and writes the totals, the per thread
+ * breakdown and the hottest accounts to the report file*/
+void writeContentionReport(char *filename, int accountCount){
+
+	FILE *report_fp = fopen(filename, "w");
+	long long *hits = calloc(accountCount + 1, sizeof(long long));	//merged number of times each account was locked
+	long long acquires = 0, waitTotal = 0, waitMax = 0, holdTotal = 0, holdMax = 0, totalHits = 0;
+	int threadCount = 0;
+	int i;
+	int j;
+	LockStats *stats;
+
+	if(report_fp == NULL){
+		printf("File %s could not be opened", filename);
+		free(hits);
+		return;
+	}
+
+	for(stats = allLockStats; stats != NULL; stats = stats->next){
+		acquires += stats->acquires;
+		waitTotal += stats->waitTotal;
+		holdTotal += stats->holdTotal;
+		waitMax = stats->waitMax > waitMax ? stats->waitMax : waitMax;
+		holdMax = stats->holdMax > holdMax ? stats->holdMax : holdMax;
+		threadCount++;
+
+		for(i = 0; i < stats->hitCapacity; i++){
+			if(stats->hitAccounts[i] != 0 && stats->hitAccounts[i] <= accountCount){
+				hits[stats->hitAccounts[i]] += stats->hitCounts[i];
+				totalHits += stats->hitCounts[i];
+			}
+		}
+	}
+
+	fprintf(report_fp, "lock mode %s, %d threads, %lld critical regions\n", lockMode == LOCK_GLOBAL ? "global" : (lockMode == LOCK_ACCOUNT ? "account" : "optimistic"), threadCount, acquires);
+	fprintf(report_fp, "wait total %.3f ms mean %.0f ns max %lld ns\n", waitTotal/1e6, acquires ? (double)waitTotal/acquires : 0.0, waitMax);
+	fprintf(report_fp, "hold total %.3f ms mean %.0f ns max %lld ns\n", holdTotal/1e6, acquires ? (double)holdTotal/acquires : 0.0, holdMax);
+
+	fprintf(report_fp, "\nper thread: critical regions, wait total ms, hold total ms\n");
+	for(stats = allLockStats, i = 0; stats != NULL; stats = stats->next, i++){
+		fprintf(report_fp, "thread %d %lld %.3f %.3f\n", i, stats->acquires, stats->waitTotal/1e6, stats->holdTotal/1e6);
+	}
+
+	/*pick out the hottest accounts, taking each one's hits out of the running once it is listed*/
+	fprintf(report_fp, "\nhottest accounts: hits, share of all hits\n");
+	for(j = 0; j < HOT_ACCOUNTS && j < accountCount; j++){
+		int hottest = 0;
+		for(i = 1; i <= accountCount; i++){
+			if(hits[i] > hits[hottest]){
+				hottest = i;
+			}
+		}
+		if(hottest == 0){
+			break;
+		}
+		fprintf(report_fp, "a%d %lld %.1f%%\n", hottest, hits[hottest], 100.0*hits[hottest]/totalHits);
+		hits[hottest] = -1;
+	}
+
+	fclose(report_fp);
+	free(hits);
+
+	while(allLockStats != NULL){
+		stats = allLockStats;
+		allLockStats = stats->next;
+		free(stats->hitAccounts);
+		free(stats->hitCounts);
+		free(stats);
+	}
+}
+
+#endif
+
+#define PIPELINE_QUEUE 1024	//number of parsed lines the pipeline queue holds before the parser waits
+
+//bounded queue of parsed depositor and client lines waiting for a pipeline worker
+typedef struct lineQueue{
+	Task lines[PIPELINE_QUEUE];	//circular buffer of lines
+	int head;			//index of the oldest line
+	int count;			//number of lines in the queue
+	int closed;			//1 once the parser has finished the file
+	pthread_mutex_t queueLock;	//lock protecting the queue
+	pthread_cond_t notEmpty;	//signalled when a line is added or the queue is closed
+	pthread_cond_t notFull;		//signalled when a line is removed
+} LineQueue;
+
+LineQueue pipelineQueue = {.queueLock = PTHREAD_MUTEX_INITIALIZER, .notEmpty = PTHREAD_COND_INITIALIZER, .notFull = PTHREAD_COND_INITIALIZER};
+pthread_t *pipelineWorkers;	//workers of the pipeline engine, started with the first depositor or client line
+int pipelineWorkerCount;	//number of pipeline workers, 0 until they are started
+int *pendingDeposits;		//number of depositor deposits parsed but not yet run on each account
+
+/*waitForDeposits waits until every depositor deposit to the account has run*/
+static void waitForDeposits(int accountNum){
+	while(__atomic_load_n(&pendingDeposits[accountNum], __ATOMIC_ACQUIRE) > 0){
+		sched_yield();
+	}
+}
+
+/*thread routine for a pipeline worker. Depositor lines are run straight away; each client transaction first waits
+ * for the depositor deposits to the accounts it touches, which replaces the barrier between depositors and clients.
+ * Depositor lines come before client lines in the file, so every depositor deposit is counted in pendingDeposits
+ * before any client line is queued, and since the queue is first in first out every depositor line has been taken
+ * by a worker that never waits before a client line is taken*/
+void *pipelineWorker(void *unused){
+
+	(void)unused;
+	Task line;
+	int accountNum1;
+	int accountNum2;
+	int i;
+
+	while(1){
+		pthread_mutex_lock(&pipelineQueue.queueLock);
+		while(pipelineQueue.count == 0 && !pipelineQueue.closed){
+			pthread_cond_wait(&pipelineQueue.notEmpty, &pipelineQueue.queueLock);
+		}
+		if(pipelineQueue.count == 0){		//queue is closed and empty so the file is done
+			pthread_mutex_unlock(&pipelineQueue.queueLock);
+			return NULL;
+		}
+		line = pipelineQueue.lines[pipelineQueue.head];
+		pipelineQueue.head = (pipelineQueue.head + 1) % PIPELINE_QUEUE;
+		pipelineQueue.count--;
+		pthread_cond_signal(&pipelineQueue.notFull);
+		pthread_mutex_unlock(&pipelineQueue.queueLock);
+
+		if(line.isDepositor){
+			runDepositBatch(line.transactions, line.numOfTrans);
+		}
+		for(i = 0; i < line.numOfTrans; i++){
+			if(line.isDepositor){
+				__atomic_sub_fetch(&pendingDeposits[line.transactions[i].giveAccountNum], 1, __ATOMIC_RELEASE);
+			}
+			else{
+				transactionAccounts(&line.transactions[i], &accountNum1, &accountNum2);
+				waitForDeposits(accountNum1);
+				waitForDeposits(accountNum2);
+				runClientTransaction(&line.transactions[i]);
+			}
+		}
+		flushLocalCounters();
+	}
+}
+
+/*pipelineLineParsed is called by the loader with every depositor and client line. The workers are started with
+ * the first line, once the account store exists, and every line is handed to them through the bounded queue*/
+void pipelineLineParsed(Task *line, int accountCount){
+
+	int i;
+
+	if(pipelineWorkerCount == 0){
+		pendingDeposits = calloc(accountCount + 1, sizeof(int));
+		pipelineWorkerCount = poolSize();
+		pipelineWorkers = malloc(sizeof(pthread_t)*pipelineWorkerCount);
+
+		for(i = 0; i < pipelineWorkerCount; i++){
+			if(pthread_create(&pipelineWorkers[i], NULL, &pipelineWorker, NULL) != 0){
+				printf("\n Error creating thread %d", i);
+			}
+			pinThread(pipelineWorkers[i], i);
+		}
+	}
+
+	if(line->isDepositor){		//count the deposits before the line can run so clients know to wait for them
+		for(i = 0; i < line->numOfTrans; i++){
+			__atomic_add_fetch(&pendingDeposits[line->transactions[i].giveAccountNum], 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	pthread_mutex_lock(&pipelineQueue.queueLock);
+	while(pipelineQueue.count == PIPELINE_QUEUE){
+		pthread_cond_wait(&pipelineQueue.notFull, &pipelineQueue.queueLock);
+	}
+	pipelineQueue.lines[(pipelineQueue.head + pipelineQueue.count) % PIPELINE_QUEUE] = *line;
+	pipelineQueue.count++;
+	pthread_cond_signal(&pipelineQueue.notEmpty);
+	pthread_mutex_unlock(&pipelineQueue.queueLock);
+}
+
+/*finishPipeline closes the queue once the whole file is parsed and waits for the workers to run what is left*/
+void finishPipeline(void){
+
+	int i;
+
+	pthread_mutex_lock(&pipelineQueue.queueLock);
+	pipelineQueue.closed = 1;
+	pthread_cond_broadcast(&pipelineQueue.notEmpty);
+	pthread_mutex_unlock(&pipelineQueue.queueLock);
+
+	for(i = 0; i < pipelineWorkerCount; i++){
+		pthread_join(pipelineWorkers[i], NULL);
+	}
+
+	free(pipelineWorkers);
+	free(pendingDeposits);
+}
+
+#define FORMAT_ACCOUNTS 65536	//minimum number of accounts worth handing to another formatting worker
+#define BALANCE_LINE_MAX 48	//longest line "a<num> type <type> <balance>\n" can take
+
+//range of accounts whose balance lines one formatting worker renders into its own buffer
+typedef struct balanceChunk{
+	int first;		//index of the first account in the range
+	int last;		//index one past the last account in the range
+	char *text;		//buffer holding the rendered lines
+	size_t length;		//number of bytes rendered into text
+	int threaded;		//1 if a worker thread was created to format the chunk
+} BalanceChunk;
+
+/*formatNumber writes value in decimal at out and returns the position just past its last digit*/
+static inline char *formatNumber(char *out, int value){
+	char digits[10];
+	unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+	int count = 0;
+
+	if(value < 0){
+		*out++ = '-';
+	}
+	do{
+		digits[count++] = '0' + magnitude%10;
+		magnitude /= 10;
+	}while(magnitude != 0);
+
+	while(count > 0){
+		*out++ = digits[--count];
+	}
+	return out;
+}
+
+/*formatBalances is the thread routine that renders the "a<num> type <type> <balance>" line of every account in a chunk*/
+void *formatBalances(void *chunk){
+
+	BalanceChunk *balanceChunk = (BalanceChunk*)chunk;
+	char *out = balanceChunk->text;
+	int i;
+
+	for(i = balanceChunk->first; i < balanceChunk->last; i++){
+		const char *typeName = accountTypeNames[accountConfig.type[i]];
+		size_t typeLength = strlen(typeName);
+
+		*out++ = 'a';
+		out = formatNumber(out, i + 1);
+		memcpy(out, " type ", 6);
+		out += 6;
+		memcpy(out, typeName, typeLength);
+		out += typeLength;
+		*out++ = ' ';
+		out = formatNumber(out, accounts[i].balance);
+		*out++ = '\n';
+	}
+
+	balanceChunk->length = out - balanceChunk->text;
+	return NULL;
+}
+
+/*writeAll writes length bytes of text to the file descriptor fd, continuing after partial writes. Returns 0 on success*/
+static int writeAll(int fd, const char *text, size_t length){
+	while(length > 0){
+		ssize_t written = write(fd, text, length);
+		if(written < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return 1;
+		}
+		text += written;
+		length -= written;
+	}
+	return 0;
+}
+
+/*writeVectorAll writes the buffers of iov in order, carrying on after a short write. Returns 0 on success*/
+static int writeVectorAll(int fd, struct iovec *iov, int count){
+	while(count > 0){
+		ssize_t written = writev(fd, iov, count);
+		if(written < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return 1;
+		}
+		while(count > 0 && (size_t)written >= iov->iov_len){
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0){
+			iov->iov_base = (char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
+
+/*writeBalances writes the final balance of every account to the output file, and to stdout unless echoBalances is
+ * off. The lines are rendered in parallel into one buffer per worker and each buffer goes out in a single write*/
+void writeBalances(int accountCount, FILE *output_fp){
+
+	int workers = poolSize();
+	int failed = 0;
+	int i;
+
+	if(workers > (accountCount + FORMAT_ACCOUNTS - 1)/FORMAT_ACCOUNTS){	//small account tables are not worth a thread
+		workers = (accountCount + FORMAT_ACCOUNTS - 1)/FORMAT_ACCOUNTS;
+	}
+	if(workers < 1){
+		workers = 1;
+	}
+
+	BalanceChunk *chunks = malloc(sizeof(BalanceChunk)*workers);
+	pthread_t *formatters = malloc(sizeof(pthread_t)*workers);
+	if(chunks == NULL || formatters == NULL){
+		fprintf(stderr, "Out of memory while writing output\n");
+		exit(1);
+	}
+
+	for(i = 0; i < workers; i++){
+		chunks[i].first = (long long)accountCount*i/workers;
+		chunks[i].last = (long long)accountCount*(i + 1)/workers;
+		chunks[i].text = malloc((size_t)BALANCE_LINE_MAX*(chunks[i].last - chunks[i].first) + 1);
+		if(chunks[i].text == NULL){
+			fprintf(stderr, "Out of memory while writing output\n");
+			exit(1);
+		}
+	}
+
+	/*the calling thread formats the first chunk while the other workers format the rest*/
+	for(i = 1; i < workers; i++){
+		chunks[i].threaded = pthread_create(&formatters[i], NULL, &formatBalances, &chunks[i]) == 0;
+		if(!chunks[i].threaded){		//format it on this thread if a worker could not be created
+			formatBalances(&chunks[i]);
+		}
+	}
+	formatBalances(&chunks[0]);
+	for(i = 1; i < workers; i++){
+		if(chunks[i].threaded){
+			pthread_join(formatters[i], NULL);
+		}
+	}
+
+	fflush(stdout);			//anything already buffered must come out before the balances
+	fflush(output_fp);
+	for(i = 0; i < workers; i++){
+		if(echoBalances){
+			failed |= writeAll(STDOUT_FILENO, chunks[i].text, chunks[i].length);
+		}
+		failed |= writeAll(fileno(output_fp), chunks[i].text, chunks[i].length);
+		free(chunks[i].text);
+	}
+	if(failed){
+		fprintf(stderr, "Output could not be written\n");
+	}
+
+	free(chunks);
+	free(formatters);
+}
+
+#define JOURNAL_MAGIC "BANKJNL"	//magic at the start of a journal, followed by a zero byte
+#define JOURNAL_VERSION 2		//version of the journal layout, bumped whenever any of the records below change
+#define JOURNAL_RING 16384		//number of records each thread can hold before the writer flushes them
+#define JOURNAL_SLICES 64		//most rings the writer appends from with one write
+#define JOURNAL_GROUP 262144		//number of unsynced records at which the writer wakes the committer early
+#define JOURNAL_COMMIT_NS 10000000	//longest time a written record waits before the committer syncs it
+
+//header at the start of a journal. The records follow on the next cache line boundary, and once the journal is
+//closed the footer holds the type of every account followed by the depositor and client lines of the input
+typedef struct journalHeader{
+	char magic[8];			//JOURNAL_MAGIC
+	uint32_t version;		//JOURNAL_VERSION of the program that wrote the journal
+	uint32_t accountCount;		//number of account types in the footer
+	uint32_t depositorCount;	//number of depositor lines in the footer, stored before the client lines
+	uint32_t clientCount;		//number of client lines in the footer
+	uint64_t recordCount;		//number of records, kept up to date with the records synced while the journal is open
+	uint64_t footerOffset;		//file offset of the footer, 0 if the journal was never closed
+} JournalHeader;
+
+//outcome of one transaction. Each balance is taken while the transaction still holds that account, so the balances
+//are the ones it left behind and the version of an account orders every record that changed it
+typedef struct journalRecord{
+	uint32_t transIndex : 31;	//position of the transaction in the input, counting every depositor and client transaction
+	uint32_t status : 1;		//TRANS_OK or TRANS_REJECTED
+	int32_t takeAccountNum;		//account withdrawn from, 0 for a deposit, a transfer has both accounts
+	int32_t giveAccountNum;		//account deposited into, 0 for a withdraw
+	int32_t amount;
+	int32_t takeBalance;		//balance of takeAccountNum after the transaction
+	int32_t giveBalance;		//balance of giveAccountNum after the transaction
+	uint32_t takeVersion;		//journal version of takeAccountNum after the transaction, 0 if the record holds no balance for it
+	uint32_t giveVersion;		//journal version of giveAccountNum after the transaction, 0 if the record holds no balance for it
+} JournalRecord;
+
+//records of one thread waiting for the writer. Only the owning thread moves head and only the writer moves tail, once
+//the records before it are written
+typedef struct journalRing{
+	JournalRecord records[JOURNAL_RING];
+	unsigned long head __attribute__((aligned(CACHE_LINE)));	//number of records appended by the owner
+	unsigned long tail __attribute__((aligned(CACHE_LINE)));	//number of records taken by the writer
+	int closed;			//1 once the owning thread has exited and will append nothing more
+	struct journalRing *next;	//next ring registered with the writer
+} JournalRing;
+
+int journalFd;				//file descriptor of the journal
+uint64_t journalWritten;		//number of records the writer has written
+uint64_t journalRecords;		//number of records the committer has synced and counted in the header
+int journalStopping;			//1 once every transaction has run and the writer should drain the rings and exit
+int journalCommitStopping;		//1 once the writer has exited and the committer should sync the last records and exit
+JournalRing *journalRings;		//rings registered with the writer
+int journalFull;			//1 if a thread is waiting for room in its ring
+pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER;	//protects the list of rings and journalFull
+pthread_cond_t journalWake = PTHREAD_COND_INITIALIZER;		//wakes the writer before its commit interval is up
+pthread_cond_t journalDrained = PTHREAD_COND_INITIALIZER;	//wakes the threads waiting for room in their rings
+pthread_cond_t journalCommitWake = PTHREAD_COND_INITIALIZER;	//wakes the committer before its commit interval is up
+pthread_key_t journalKey;		//closes a thread's ring when the thread exits
+pthread_t journalWriterThread;
+pthread_t journalCommitterThread;
+static __thread JournalRing *journalRing;	//ring of the calling thread
+
+/*closeJournalRing runs when a thread with a ring exits and hands the ring over to the writer to drain and free*/
+static void closeJournalRing(void *ring){
+	__atomic_store_n(&((JournalRing*)ring)->closed, 1, __ATOMIC_RELEASE);
+}
+
+//records of one ring the writer is appending, which stay in the ring until they are written
+typedef struct journalSlice{
+	JournalRing *ring;
+	unsigned long head;		//tail of the ring once the slice is written
+} JournalSlice;
+
+/*gatherJournalRings points iov at the waiting records of up to JOURNAL_SLICES rings, two entries for a ring whose
+ * records wrap around its end, and frees the rings of threads that have exited once all of their records are written.
+ * Stores the rings in slices and returns the number of rings gathered, with the number of records in records*/
+static int gatherJournalRings(struct iovec *iov, int *iovCount, JournalSlice *slices, uint64_t *records){
+
+	JournalRing **link = &journalRings;
+	int count = 0;
+
+	*iovCount = 0;
+	*records = 0;
+	pthread_mutex_lock(&journalLock);
+	while(*link != NULL && count < JOURNAL_SLICES){
+		JournalRing *ring = *link;
+		int closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);	//read before head so a closed ring's head is final
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = ring->tail;
+
+		if(closed && tail == head){
+			*link = ring->next;
+			free(ring);
+			continue;
+		}
+		link = &ring->next;
+		if(tail == head){
+			continue;
+		}
+
+		unsigned long wrap = tail + (JOURNAL_RING - tail % JOURNAL_RING);	//first record past the end of the ring
+		unsigned long end = head < wrap ? head : wrap;
+		iov[*iovCount].iov_base = &ring->records[tail % JOURNAL_RING];
+		iov[(*iovCount)++].iov_len = sizeof(JournalRecord)*(end - tail);
+		if(end != head){
+			iov[*iovCount].iov_base = &ring->records[0];
+			iov[(*iovCount)++].iov_len = sizeof(JournalRecord)*(head - end);
+		}
+		slices[count].ring = ring;
+		slices[count++].head = head;
+		*records += head - tail;
+	}
+	pthread_mutex_unlock(&journalLock);
+
+	return count;
+}
+
+/*releaseJournalSlices gives the written records of every slice back to their rings and wakes the threads waiting
+ * for room*/
+static void releaseJournalSlices(JournalSlice *slices, int count){
+
+	int i;
+
+	for(i = 0; i < count; i++){
+		__atomic_store_n(&slices[i].ring->tail, slices[i].head, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_lock(&journalLock);
+	if(journalFull){
+		journalFull = 0;
+		pthread_cond_broadcast(&journalDrained);
+	}
+	pthread_mutex_unlock(&journalLock);
+}
+
+/*journalDeadline sets deadline one commit interval from now, for a timed wait on one of the journal's conditions*/
+static void journalDeadline(struct timespec *deadline){
+
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_nsec += JOURNAL_COMMIT_NS;
+	deadline->tv_sec += deadline->tv_nsec/1000000000;
+	deadline->tv_nsec %= 1000000000;
+}
+
+/*thread routine for the journal writer. Whenever it is woken, at the latest every commit interval, it appends the
+ * records waiting in every thread's ring to the journal. It never syncs, so a thread waiting for room in its ring
+ * only ever waits for a write to the page cache*/
+void *journalWriter(void *arg){
+
+	(void)arg;
+	struct iovec iov[2*JOURNAL_SLICES];
+	JournalSlice slices[JOURNAL_SLICES];
+	struct timespec deadline;
+
+	while(1){
+		int stopping = __atomic_load_n(&journalStopping, __ATOMIC_ACQUIRE);
+		uint64_t written = 0;
+		uint64_t records;
+		int iovCount;
+		int count;
+
+		while((count = gatherJournalRings(iov, &iovCount, slices, &records)) > 0){
+			if(writeVectorAll(journalFd, iov, iovCount) != 0){
+				fprintf(stderr, "Journal could not be written\n");
+				exit(1);
+			}
+			releaseJournalSlices(slices, count);
+			written += records;
+			if(__atomic_add_fetch(&journalWritten, records, __ATOMIC_RELEASE) - __atomic_load_n(&journalRecords, __ATOMIC_RELAXED) >= JOURNAL_GROUP){
+				pthread_mutex_lock(&journalLock);
+				pthread_cond_signal(&journalCommitWake);
+				pthread_mutex_unlock(&journalLock);
+			}
+		}
+
+		if(written == 0 && stopping){		//every ring was empty after the last transaction ran
+			break;
+		}
+		if(written == 0){
+			journalDeadline(&deadline);
+			pthread_mutex_lock(&journalLock);
+			if(!journalFull && !__atomic_load_n(&journalStopping, __ATOMIC_ACQUIRE)){
+				pthread_cond_timedwait(&journalWake, &journalLock, &deadline);
+			}
+			pthread_mutex_unlock(&journalLock);
+		}
+	}
+
+	return NULL;
+}
+
+/*thread routine for the journal committer. Every commit interval, or once JOURNAL_GROUP records are waiting, it syncs
+ * the records the writer has written with a single sync, so a group of transactions is committed together and is
+ * durable once the sync returns. Only then is the header's record count moved past the group, so replay never reads
+ * records that were not synced. The next sync makes the count itself durable, and until then it is only behind. The
+ * writer keeps draining the rings while a sync runs*/
+void *journalCommitter(void *arg){
+
+	(void)arg;
+	struct timespec deadline;
+
+	while(1){
+		int stopping = __atomic_load_n(&journalCommitStopping, __ATOMIC_ACQUIRE);	//read before the count so the last records are seen
+		uint64_t written = __atomic_load_n(&journalWritten, __ATOMIC_ACQUIRE);
+
+		if(written != journalRecords){
+			if(fdatasync(journalFd) != 0 || pwrite(journalFd, &written, sizeof(written), offsetof(JournalHeader, recordCount)) != sizeof(written)){
+				fprintf(stderr, "Journal could not be written\n");
+				exit(1);
+			}
+			__atomic_store_n(&journalRecords, written, __ATOMIC_RELAXED);
+		}
+		if(stopping){
+			break;
+		}
+		journalDeadline(&deadline);
+		pthread_mutex_lock(&journalLock);
+		if(!journalCommitStopping){
+			pthread_cond_timedwait(&journalCommitWake, &journalLock, &deadline);
+		}
+		pthread_mutex_unlock(&journalLock);
+	}
+
+	return NULL;
+}
+
+/*startJournal creates the journal and starts its writer and committer. Returns 0 on success*/
+int startJournal(char *journalname){
+
+	JournalHeader header;
+
+	journalFd = open(journalname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(journalFd < 0){
+		printf("File %s could not be opened", journalname);
+		return 1;
+	}
+
+	memset(&header, 0, sizeof(header));		//the counts and footer are filled in when the journal is closed
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+	header.version = JOURNAL_VERSION;
+	if(pwrite(journalFd, &header, sizeof(header), 0) != sizeof(header) || lseek(journalFd, alignImageOffset(sizeof(header)), SEEK_SET) < 0){
+		fprintf(stderr, "Journal could not be written\n");
+		return 1;
+	}
+
+	if(pthread_key_create(&journalKey, &closeJournalRing) != 0 || pthread_create(&journalWriterThread, NULL, &journalWriter, NULL) != 0
+		|| pthread_create(&journalCommitterThread, NULL, &journalCommitter, NULL) != 0){
+		printf("\n Error creating journal writer");
+		return 1;
+	}
+	journaling = 1;
+	return 0;
+}
+
+/*journalOutcome appends the outcome of a transaction to the calling thread's ring, with the balance it left on each
+ * account and the journal version it gave that account while holding it. A version of 0 holds no balance, for a side
+ * the transaction did not change or whose balance a later record supersedes*/
+void journalOutcome(Trans *transaction, int status, int takeBalance, unsigned int takeVersion, int giveBalance, unsigned int giveVersion){
+
+	JournalRing *ring = journalRing;
+	JournalRecord *record;
+
+	if(ring == NULL){				//first record of this thread
+		ring = aligned_alloc(CACHE_LINE, sizeof(JournalRing));
+		if(ring == NULL){
+			fprintf(stderr, "Out of memory while writing the journal\n");
+			exit(1);
+		}
+		ring->head = 0;
+		ring->tail = 0;
+		ring->closed = 0;
+
+		pthread_mutex_lock(&journalLock);
+		ring->next = journalRings;
+		journalRings = ring;
+		pthread_mutex_unlock(&journalLock);
+
+		pthread_setspecific(journalKey, ring);
+		journalRing = ring;
+	}
+
+	if(ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == JOURNAL_RING){	//wake the writer and wait for it to make room
+		pthread_mutex_lock(&journalLock);
+		while(ring->head - ring->tail == JOURNAL_RING){
+			journalFull = 1;
+			pthread_cond_signal(&journalWake);
+			pthread_cond_wait(&journalDrained, &journalLock);
+		}
+		pthread_mutex_unlock(&journalLock);
+	}
+
+	record = &ring->records[ring->head % JOURNAL_RING];
+	record->transIndex = transaction - transArena;
+	record->status = status;
+	record->takeAccountNum = transaction->takeAccountNum;
+	record->giveAccountNum = transaction->giveAccountNum;
+	record->amount = transaction->amount;
+	record->takeBalance = takeBalance;
+	record->takeVersion = takeVersion;
+	record->giveBalance = giveBalance;
+	record->giveVersion = giveVersion;
+
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/*journalTransaction journals a transaction that holds all of its accounts. It must run inside the transaction's
+ * critical region, right after the transaction was applied*/
+void journalTransaction(Trans *transaction, int status){
+
+	int takeBalance = 0;
+	int giveBalance = 0;
+	unsigned int takeVersion = 0;
+	unsigned int giveVersion = 0;
+
+	if(transaction->takeAccountNum > 0){
+		takeVersion = ++accounts[transaction->takeAccountNum - 1].journalVersion;
+		takeBalance = accounts[transaction->takeAccountNum - 1].balance;
+	}
+	if(transaction->giveAccountNum > 0){
+		if(transaction->giveAccountNum != transaction->takeAccountNum){
+			++accounts[transaction->giveAccountNum - 1].journalVersion;
+		}
+		giveVersion = accounts[transaction->giveAccountNum - 1].journalVersion;
+		giveBalance = accounts[transaction->giveAccountNum - 1].balance;
+	}
+	journalOutcome(transaction, status, takeBalance, takeVersion, giveBalance, giveVersion);
+}
+
+/*stopJournal waits for the writer to flush every record and the committer to sync them, then closes the journal by
+ * writing the footer and the final header and syncing it to disk. The record count is synced before the footer is
+ * appended and the footer before the header points at it, so a journal cut short at any point is still read as an
+ * open journal of whole records. It must only be called once every transaction has run. Returns 0 on success*/
+int stopJournal(int accountCount, Depo *depositors, int depositorCount, Cli *clients, int clientCount){
+
+	JournalHeader header;
+	ImageLine line;
+	int failed = 0;
+	int i;
+
+	pthread_mutex_lock(&journalLock);
+	__atomic_store_n(&journalStopping, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&journalWake);
+	pthread_mutex_unlock(&journalLock);
+	pthread_join(journalWriterThread, NULL);
+	pthread_mutex_lock(&journalLock);
+	__atomic_store_n(&journalCommitStopping, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&journalCommitWake);
+	pthread_mutex_unlock(&journalLock);
+	pthread_join(journalCommitterThread, NULL);
+
+	while(journalRings != NULL){			//rings of threads that are still alive
+		JournalRing *ring = journalRings;
+		journalRings = ring->next;
+		free(ring);
+	}
+	journalRing = NULL;
+	pthread_key_delete(journalKey);
+	journaling = 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+	header.version = JOURNAL_VERSION;
+	header.accountCount = accountCount;
+	header.depositorCount = depositorCount;
+	header.clientCount = clientCount;
+	header.recordCount = journalRecords;
+	header.footerOffset = alignImageOffset(sizeof(header)) + sizeof(JournalRecord)*journalRecords;
+
+	failed |= fdatasync(journalFd) != 0;		//the committer's last record count
+
+	/*footer: the account types, then the depositor and client lines on the next 8 byte boundary*/
+	failed |= writeAll(journalFd, (char*)accountConfig.type, accountCount);
+	memset(&line, 0, sizeof(line));
+	failed |= writeAll(journalFd, (char*)&line, (8 - accountCount % 8) % 8);
+	for(i = 0; i < depositorCount; i++){
+		line.firstTrans = depositors[i].transactions - transArena;
+		line.numOfTrans = depositors[i].numOfTrans;
+		failed |= writeAll(journalFd, (char*)&line, sizeof(line));
+	}
+	for(i = 0; i < clientCount; i++){
+		line.firstTrans = clients[i].transactions - transArena;
+		line.numOfTrans = clients[i].numOfTrans;
+		failed |= writeAll(journalFd, (char*)&line, sizeof(line));
+	}
+	failed |= fdatasync(journalFd) != 0;
+
+	failed |= pwrite(journalFd, &header, sizeof(header), 0) != sizeof(header);
+	failed |= fdatasync(journalFd) != 0;
+	failed |= close(journalFd) != 0;
+	if(failed){
+		fprintf(stderr, "Journal could not be written\n");
+	}
+	return failed;
+}
+
+/*replayJournal rebuilds the final balance of every account from a journal and writes them out the same way a run
+ * does. The balance of an account is the one left by the record with its highest version; accounts no record touched
+ * keep a balance of 0. It also checks that every transaction of the input has exactly one record. A journal that was
+ * never closed has no footer, so only the records its header counts as synced are replayed and the accounts and lines
+ * are taken from the input file or compiled image instead. Returns 0 on success*/
+int replayJournal(char *journalname, char *filename, char *imagename, FILE *output_fp){
+
+	struct stat info;
+	int fd;
+	uint64_t i;
+
+	fd = open(journalname, O_RDONLY);
+	if(fd < 0 || fstat(fd, &info) != 0){
+		printf("File %s could not be opened", journalname);
+		return 1;
+	}
+
+	size_t journalSize = info.st_size;
+	char *journal = journalSize >= sizeof(JournalHeader) ? mmap(NULL, journalSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(journal == MAP_FAILED){
+		fprintf(stderr, "File %s is not a journal\n", journalname);
+		return 1;
+	}
+
+	JournalHeader *header = (JournalHeader*)journal;
+	int closed = header->footerOffset != 0;
+	uint64_t lineCount = (uint64_t)header->depositorCount + header->clientCount;
+	uint64_t recordOffset = alignImageOffset(sizeof(JournalHeader));
+	uint64_t lineOffset = header->footerOffset + ((uint64_t)header->accountCount + 7)/8*8;
+	uint64_t recordCount = header->recordCount;
+
+	if(!closed){		//only the records the writer synced are read, whatever follows them may be torn or part of a footer
+		uint64_t fileRecords = journalSize > recordOffset ? (journalSize - recordOffset)/sizeof(JournalRecord) : 0;
+		recordCount = recordCount < fileRecords ? recordCount : fileRecords;
+	}
+
+	if(memcmp(header->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 || header->version != JOURNAL_VERSION
+		|| (closed && (header->accountCount > INT32_MAX
+		|| !imageSectionFits(recordOffset, header->recordCount, sizeof(JournalRecord), journalSize)
+		|| recordOffset + sizeof(JournalRecord)*header->recordCount != header->footerOffset
+		|| !imageSectionFits(header->footerOffset, header->accountCount, 1, journalSize)
+		|| !imageSectionFits(lineOffset, lineCount, sizeof(ImageLine), journalSize)))){
+		fprintf(stderr, "File %s is not a journal of version %d\n", journalname, JOURNAL_VERSION);
+		munmap(journal, journalSize);
+		return 1;
+	}
+
+	int accountCount = header->accountCount;
+	uint64_t depositorLines = header->depositorCount;
+	JournalRecord *records = (JournalRecord*)(journal + recordOffset);
+	ImageLine *lines = (ImageLine*)(journal + lineOffset);
+	ImageLine *inputLines = NULL;		//lines of the input when the journal has no footer
+	uint64_t transCount = 0;
+
+	if(closed){
+		unsigned char *types = (unsigned char*)(journal + header->footerOffset);
+		AccSpec *specs = calloc(accountCount > 0 ? accountCount : 1, sizeof(AccSpec));
+		int account;
+		if(specs == NULL){
+			fprintf(stderr, "Out of memory while replaying the journal\n");
+			exit(1);
+		}
+		for(account = 0; account < accountCount; account++){
+			specs[account].type = types[account] == ACCOUNT_BUSINESS ? ACCOUNT_BUSINESS : ACCOUNT_PERSONAL;
+		}
+		buildAccountStore(specs, accountCount);
+		free(specs);
+	}
+	else{
+		Depo *depositors;
+		Cli *clients;
+		int depositorCount = 0;
+		int clientCount = 0;
+		int loadFailed;
+		int line;
+
+		fprintf(stderr, "journal %s was not closed, replaying the records it synced\n", journalname);
+		if(imagename != NULL){
+			loadFailed = loadImage(imagename, &accountCount, &depositors, &depositorCount, &clients, &clientCount, NULL);
+		}
+		else{
+			loadFailed = loadInput(filename, &accountCount, &depositors, &depositorCount, &clients, &clientCount, NULL);
+		}
+		if(loadFailed){
+			munmap(journal, journalSize);
+			return 1;
+		}
+
+		depositorLines = depositorCount;
+		lineCount = (uint64_t)depositorCount + clientCount;
+		inputLines = calloc(lineCount > 0 ? lineCount : 1, sizeof(ImageLine));
+		if(inputLines == NULL){
+			fprintf(stderr, "Out of memory while replaying the journal\n");
+			exit(1);
+		}
+		for(line = 0; line < depositorCount; line++){
+			inputLines[line].firstTrans = depositors[line].transactions - transArena;
+			inputLines[line].numOfTrans = depositors[line].numOfTrans;
+		}
+		for(line = 0; line < clientCount; line++){
+			inputLines[depositorCount + line].firstTrans = clients[line].transactions - transArena;
+			inputLines[depositorCount + line].numOfTrans = clients[line].numOfTrans;
+		}
+		lines = inputLines;
+
+		if(inputImage != NULL){
+			munmap(inputImage, inputImageSize);
+		}
+		else{
+			munmap(transArena, transArenaSize);
+		}
+		free(depositors);
+		free(clients);
+	}
+
+	for(i = 0; i < lineCount; i++){
+		if(lines[i].firstTrans + lines[i].numOfTrans > transCount){
+			transCount = lines[i].firstTrans + lines[i].numOfTrans;
+		}
+	}
+
+	unsigned int *versions = calloc(accountCount + 1, sizeof(unsigned int));	//highest version replayed for each account
+	unsigned char *seen = calloc(transCount > 0 ? transCount : 1, 1);		//number of records of each transaction, capped at 2
+	if(versions == NULL || seen == NULL){
+		fprintf(stderr, "Out of memory while replaying the journal\n");
+		exit(1);
+	}
+
+	uint64_t rejected = 0;
+	uint64_t duplicated = 0;
+	for(i = 0; i < recordCount; i++){
+		JournalRecord *record = &records[i];
+
+		if(record->takeAccountNum > 0 && record->takeAccountNum <= accountCount && record->takeVersion > versions[record->takeAccountNum]){
+			versions[record->takeAccountNum] = record->takeVersion;
+			accounts[record->takeAccountNum - 1].balance = record->takeBalance;
+		}
+		if(record->giveAccountNum > 0 && record->giveAccountNum <= accountCount && record->giveVersion > versions[record->giveAccountNum]){
+			versions[record->giveAccountNum] = record->giveVersion;
+			accounts[record->giveAccountNum - 1].balance = record->giveBalance;
+		}
+
+		rejected += record->status != TRANS_OK;
+		if(record->transIndex < transCount && seen[record->transIndex] < 2){
+			duplicated += seen[record->transIndex]++ == 1;
+		}
+	}
+
+	/*report the transactions of the input without a record, naming the first one by its line*/
+	uint64_t missing = 0;
+	for(i = 0; i < lineCount; i++){
+		uint32_t j;
+		for(j = 0; j < lines[i].numOfTrans; j++){
+			if(!seen[lines[i].firstTrans + j] && missing++ == 0){
+				fprintf(stderr, "transaction %u of %s%llu has no journal record\n", j + 1, i < depositorLines ? "dep" : "c",
+					(unsigned long long)(i < depositorLines ? i + 1 : i - depositorLines + 1));
+			}
+		}
+	}
+	fprintf(stderr, "replayed %llu records, %llu rejected, %llu duplicated, %llu transactions missing\n", (unsigned long long)recordCount,
+		(unsigned long long)rejected, (unsigned long long)duplicated, (unsigned long long)missing);
+
+	writeBalances(accountCount, output_fp);
+
+	freeAccountStore(accountCount);
+	free(versions);
+	free(seen);
+	free(inputLines);
+	munmap(journal, journalSize);
+
+	return missing > 0 || duplicated > 0;
+}
+
+#define SNAPSHOT_ATTEMPTS 8	//number of times readBank collects the accounts before giving up on a consistent view
+#define SNAPSHOT_EVERY 4096	//number of account reads a query thread makes between whole bank snapshots
+
+/*readAccount reads a consistent balance and transaction count of the account accountNum without taking any lock,
+ * retrying while a writer is changing the account*/
+void readAccount(int accountNum, AccBalance *view){
+
+	Acc *account = &accounts[accountNum - 1];
+	unsigned int before;
+	unsigned int after;
+
+	do{
+		before = __atomic_load_n(&account->snapshotSequence, __ATOMIC_ACQUIRE);
+		view->balanceWord = __atomic_load_n(&account->balanceWord, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);	//the word must be read before the sequence is checked again
+		after = __atomic_load_n(&account->snapshotSequence, __ATOMIC_RELAXED);
+	}while((before & 1) || before != after);
+}
+
+/*readBank reads every account into views without blocking the writers. Each attempt collects the sequences and
+ * balances of all the accounts and then checks that none of them changed in the meantime, in which case the views
+ * all held at the same moment and 1 is returned. If no attempt succeeds, every view is still consistent on its own
+ * and 0 is returned. sequences is scratch space for one sequence per account*/
+int readBank(AccBalance *views, unsigned int *sequences, int accountCount){
+
+	int attempt;
+	int i;
+
+	for(attempt = 0; attempt < SNAPSHOT_ATTEMPTS; attempt++){
+		int unchanged = 1;
+
+		for(i = 0; i < accountCount; i++){
+			sequences[i] = __atomic_load_n(&accounts[i].snapshotSequence, __ATOMIC_ACQUIRE);
+			views[i].balanceWord = __atomic_load_n(&accounts[i].balanceWord, __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		/*the words are compared as well since the lock-free deposits and the local counter merges change an
+		 * account in a single atomic step without touching its sequence*/
+		for(i = 0; i < accountCount && unchanged; i++){
+			unchanged = !(sequences[i] & 1) && sequences[i] == __atomic_load_n(&accounts[i].snapshotSequence, __ATOMIC_RELAXED)
+				&& views[i].balanceWord == __atomic_load_n(&accounts[i].balanceWord, __ATOMIC_RELAXED);
+		}
+		if(unchanged){
+			return 1;
+		}
+	}
+
+	for(i = 0; i < accountCount; i++){
+		readAccount(i + 1, &views[i]);
+	}
+	return 0;
+}
+
+//work done by one query thread
+typedef struct queryStats{
+	pthread_t thread;
+	unsigned int seed;		//state of the thread's random account choice
+	unsigned long long accountReads;	//number of single account reads
+	unsigned long long bankReads;		//number of whole bank snapshots
+	unsigned long long consistentReads;	//number of whole bank snapshots that held at a single moment
+} QueryStats;
+
+QueryStats *queryStats;		//one entry per query thread
+int queryAccountCount;		//number of accounts the query threads read
+int queriesDone;		//1 once the transactions have run and the query threads should stop
+long long queriesStart;		//time the query threads were started
+
+/*thread routine for a query thread. It reads random accounts while the transactions run and takes a whole bank
+ * snapshot every SNAPSHOT_EVERY reads*/
+void *queryWorker(void *stats){
+
+	QueryStats *queryStat = (QueryStats*)stats;
+	AccBalance *views = malloc(sizeof(AccBalance)*(queryAccountCount > 0 ? queryAccountCount : 1));
+	unsigned int *sequences = malloc(sizeof(unsigned int)*(queryAccountCount > 0 ? queryAccountCount : 1));
+	AccBalance view;
+
+	if(views == NULL || sequences == NULL){
+		fprintf(stderr, "Out of memory while running queries\n");
+		exit(1);
+	}
+
+	while(queryAccountCount > 0 && !__atomic_load_n(&queriesDone, __ATOMIC_RELAXED)){
+		int i;
+
+		for(i = 0; i < SNAPSHOT_EVERY; i++){
+			queryStat->seed = queryStat->seed*1103515245 + 12345;
+			readAccount((queryStat->seed >> 8) % queryAccountCount + 1, &view);
+		}
+		queryStat->accountReads += SNAPSHOT_EVERY;
+
+		queryStat->consistentReads += readBank(views, sequences, queryAccountCount);
+		queryStat->bankReads++;
+		sched_yield();		//let writers waiting for a core run, the shard workers pass each transaction between threads
+	}
+
+	free(views);
+	free(sequences);
+	return NULL;
+}
+
+/*startQueries starts queryReaders query threads over the first accountCount accounts*/
+void startQueries(int accountCount){
+
+	int i;
+
+	queryAccountCount = accountCount;
+	queriesDone = 0;
+	queryStats = calloc(queryReaders, sizeof(QueryStats));
+	if(queryStats == NULL){
+		fprintf(stderr, "Out of memory while running queries\n");
+		exit(1);
+	}
+
+	queriesStart = nowNanoseconds();
+	for(i = 0; i < queryReaders; i++){
+		queryStats[i].seed = i + 1;
+		if(pthread_create(&queryStats[i].thread, NULL, &queryWorker, &queryStats[i]) != 0){
+			printf("\n Error creating thread %d", i);
+		}
+	}
+}
+
+/*stopQueries stops the query threads and reports their read throughput to stderr in the form
+ * "queries readers R account_reads N reads_per_sec T snapshots S consistent C"*/
+void stopQueries(void){
+
+	unsigned long long accountReads = 0;
+	unsigned long long bankReads = 0;
+	unsigned long long consistentReads = 0;
+	int i;
+
+	__atomic_store_n(&queriesDone, 1, __ATOMIC_RELAXED);
+	for(i = 0; i < queryReaders; i++){
+		pthread_join(queryStats[i].thread, NULL);
+		accountReads += queryStats[i].accountReads;
+		bankReads += queryStats[i].bankReads;
+		consistentReads += queryStats[i].consistentReads;
+	}
+
+	double seconds = (nowNanoseconds() - queriesStart)/1e9;
+	fprintf(stderr, "queries readers %d account_reads %llu reads_per_sec %.0f snapshots %llu consistent %llu\n", queryReaders,
+		accountReads, seconds > 0 ? accountReads/seconds : 0.0, bankReads, consistentReads);
+
+	free(queryStats);
+}
+
+#define SHARD_INBOX 1024	//number of messages each shard's inbox holds, also the most shards a run uses
+#define SHARD_SLICE 64		//number of transactions a task can run straight through before the next task gets a turn
+
+//steps a transaction goes through in the shard engine; each step runs on the shard owning the account it touches
+enum shardStep{
+	SHARD_APPLY,		//deposit or withdraw
+	SHARD_RESERVE,		//first phase of a transfer, on the sending account
+	SHARD_COMMIT,		//second phase of a transfer, on the receiving account
+	SHARD_RELEASE,		//refund of the sending account after the receiving account rejected a transfer
+	SHARD_DONE		//the transaction has finished, back on the shard driving its depositor or client
+};
+
+//message passing the next step of a transaction to the shard that runs it
+typedef struct shardMessage{
+	Trans *transaction;	//transaction the message belongs to
+	int task;		//index of the depositor or client among the tasks of the driving shard
+	short driver;		//shard driving the depositor or client
+	char step;		//step to run next
+} ShardMessage;
+
+//slot of a shard's inbox. Its sequence tells the senders and the receiving shard whose turn the slot is
+typedef struct shardSlot{
+	unsigned long sequence;	//position of the next message sent into the slot, or that plus 1 once the message is in
+	ShardMessage message;
+} ShardSlot;
+
+//multiple producer single consumer queue of the messages every other shard sends to one shard
+typedef struct shardInbox{
+	ShardSlot slots[SHARD_INBOX];
+	unsigned long head __attribute__((aligned(CACHE_LINE)));	//number of positions claimed by the sending shards
+	unsigned long tail __attribute__((aligned(CACHE_LINE)));	//number of messages received, only moved by the receiving shard
+} ShardInbox;
+
+//a shard: the depositors or clients it drives through their transactions one at a time
+typedef struct shard{
+	Task **tasks;		//tasks driven by this shard
+	int taskCount;		//number of tasks driven by this shard
+	char *waiting;		//1 for each task whose current transaction is still running on another shard
+	long long *issued;	//time the current transaction of each task started, for the benchmark
+	int inFlight;		//number of tasks waiting on another shard
+} Shard;
+
+Shard *shards;			//one shard per worker
+ShardInbox *shardInboxes;	//inbox of each shard
+int shardCount;			//number of shards
+int shardWidth;			//number of accounts owned by each shard, the last shard may own fewer
+int shardInFlight;		//most tasks a shard lets wait on other shards, so that no inbox can fill up
+int shardTasksLeft;		//number of tasks that still have transactions to run
+
+/*shardOf returns the shard owning the account accountNum*/
+static inline int shardOf(int accountNum){
+	return (accountNum - 1)/shardWidth;
+}
+
+/*pushShardMessage sends a message to shard to. A transaction has at most one message on its way at a time, so an
+ * inbox never holds more messages than there are transactions in flight across all shards. shardInFlight keeps those
+ * at or below SHARD_INBOX, so the wait below is only a safeguard*/
+static void pushShardMessage(int to, ShardMessage *message){
+
+	ShardInbox *inbox = &shardInboxes[to];
+	unsigned long position = __atomic_fetch_add(&inbox->head, 1, __ATOMIC_RELAXED);
+	ShardSlot *slot = &inbox->slots[position % SHARD_INBOX];
+
+	while(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != position){	//the message a lap earlier is still unread
+		sched_yield();
+	}
+	slot->message = *message;
+	__atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+/*popShardMessage takes the next message from the inbox of shard self into message. Returns 0 if there is none*/
+static int popShardMessage(int self, ShardMessage *message){
+
+	ShardInbox *inbox = &shardInboxes[self];
+	ShardSlot *slot = &inbox->slots[inbox->tail % SHARD_INBOX];
+
+	if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != inbox->tail + 1){
+		return 0;
+	}
+	*message = slot->message;
+	__atomic_store_n(&slot->sequence, inbox->tail + SHARD_INBOX, __ATOMIC_RELEASE);	//free for the message a lap later
+	inbox->tail++;
+	return 1;
+}
+
+/*finishShardTransaction completes the current transaction of one of the shard's tasks and moves the task on to its
+ * next transaction*/
+static void finishShardTransaction(int self, int taskIndex){
+
+	Shard *shard = &shards[self];
+	Task *task = shard->tasks[taskIndex];
+
+	if(shard->waiting[taskIndex]){
+		shard->waiting[taskIndex] = 0;
+		shard->inFlight--;
+	}
+	if(benchmark){
+		recordLatency(shard->issued[taskIndex]);
+	}
+	if(++task->next == task->numOfTrans){
+		__atomic_sub_fetch(&shardTasksLeft, 1, __ATOMIC_RELEASE);
+	}
+}
+
+/*runShardStep runs the next step of a message on shard self and turns the message into the step after it. Only
+ * accounts owned by self are touched, so no locks are needed. Returns 0 once the transaction has finished*/
+static int runShardStep(int self, ShardMessage *message){
+
+	Trans *transaction = message->transaction;
+	int accountNum = message->step == SHARD_COMMIT || transaction->transType == 'd' ? transaction->giveAccountNum : transaction->takeAccountNum;
+	int status = TRANS_OK;
+
+	if(message->step == SHARD_DONE){
+		finishShardTransaction(self, message->task);
+		return 0;
+	}
+
+	if(queryReaders){
+		beginAccountWrite(accountNum, accountNum);
+	}
+
+	if(message->step == SHARD_APPLY){
+		applyTransaction(transaction);
+		message->step = SHARD_DONE;
+	}
+	else if(message->step == SHARD_RESERVE){
+		status = transferReserve(transaction->takeAccountNum, transaction->amount);
+		message->step = status == TRANS_OK ? SHARD_COMMIT : SHARD_DONE;
+	}
+	else if(message->step == SHARD_COMMIT){
+		status = transferCommit(transaction->giveAccountNum, transaction->amount);
+		message->step = status == TRANS_OK ? SHARD_DONE : SHARD_RELEASE;	//a rejected commit is refunded on the sending shard
+	}
+	else{
+		transferRelease(transaction->takeAccountNum, transaction->amount);
+		message->step = SHARD_DONE;
+	}
+
+	if(queryReaders){
+		endAccountWrite(accountNum, accountNum);
+	}
+	return 1;
+}
+
+/*routeShardMessage runs the steps of a message for as long as they belong to shard self and sends the message on
+ * to the shard owning the next step's account once they do not*/
+static void routeShardMessage(int self, ShardMessage *message){
+
+	while(1){
+		int target;
+
+		if(message->step == SHARD_DONE){
+			target = message->driver;
+		}
+		else if(message->step == SHARD_COMMIT || message->transaction->transType == 'd'){
+			target = shardOf(message->transaction->giveAccountNum);
+		}
+		else{
+			target = shardOf(message->transaction->takeAccountNum);
+		}
+
+		if(target != self){
+			pushShardMessage(target, message);
+			return;
+		}
+		if(!runShardStep(self, message)){
+			return;
+		}
+	}
+}
+
+/*thread routine for a shard worker. It starts the next transaction of each of its tasks that is not waiting on
+ * another shard, running it straight through when every account is its own, and runs the steps other shards send
+ * it, until every task of every shard is done*/
+void *shardWorker(void *worker){
+
+	int self = (int)(intptr_t)worker;
+	Shard *shard = &shards[self];
+	ShardMessage message;
+	int i;
+
+	while(__atomic_load_n(&shardTasksLeft, __ATOMIC_ACQUIRE) > 0){
+		int progress = 0;
+
+		/*start transactions of the tasks that are free, keeping within the in flight limit*/
+		for(i = 0; i < shard->taskCount && shard->inFlight < shardInFlight; i++){
+			Task *task = shard->tasks[i];
+			int budget = SHARD_SLICE;		//transactions a task may run straight through before the next task gets a turn
+
+			while(!shard->waiting[i] && task->next < task->numOfTrans && budget-- > 0){
+				Trans *transaction = &task->transactions[task->next];
+
+				message.transaction = transaction;
+				message.task = i;
+				message.driver = self;
+				message.step = transaction->transType == 't' ? SHARD_RESERVE : SHARD_APPLY;
+
+				shard->waiting[i] = 1;
+				shard->inFlight++;
+				if(benchmark){
+					shard->issued[i] = nowNanoseconds();
+				}
+				routeShardMessage(self, &message);	//finishes the transaction here unless it had to leave the shard
+				progress = 1;
+			}
+		}
+
+		/*run the steps the other shards have sent*/
+		while(popShardMessage(self, &message)){
+			routeShardMessage(self, &message);
+			progress = 1;
+		}
+
+		if(!progress){
+			sched_yield();
+		}
+	}
+
+	flushLocalCounters();
+	return NULL;
+}
+
+/*runShards runs the tasks on one shard per core. Every shard owns a contiguous range of the accounts and is the
+ * only one to touch them, and drives an equal share of the tasks. A transaction whose account belongs to another
+ * shard is sent there as a message; a transfer across shards is a reserve message to the sending account's shard,
+ * then a commit message to the receiving account's shard and, if the commit is rejected, a release message back to
+ * refund the sender. Each task waits for its current transaction to finish before starting the next, so program
+ * order is kept*/
+void runShards(Task *tasks, int taskCount, int accountCount){
+
+	int i;
+
+	if(taskCount == 0 || accountCount == 0){
+		return;
+	}
+
+	shardCount = poolSize();
+	if(shardCount > SHARD_INBOX){		//every shard may keep at least one task in flight
+		shardCount = SHARD_INBOX;
+	}
+	if(shardCount > accountCount){		//every shard owns at least one account
+		shardCount = accountCount;
+	}
+	shardWidth = (accountCount + shardCount - 1)/shardCount;
+	shardCount = (accountCount + shardWidth - 1)/shardWidth;
+	shardInFlight = SHARD_INBOX/shardCount;
+	shardTasksLeft = 0;
+
+	shards = calloc(shardCount, sizeof(Shard));
+	shardInboxes = aligned_alloc(CACHE_LINE, sizeof(ShardInbox)*shardCount);
+	pthread_t *workers = malloc(sizeof(pthread_t)*shardCount);
+	if(shards == NULL || shardInboxes == NULL || workers == NULL){
+		fprintf(stderr, "Out of memory while starting the shards\n");
+		exit(1);
+	}
+
+	for(i = 0; i < shardCount; i++){
+		int slot;
+
+		for(slot = 0; slot < SHARD_INBOX; slot++){
+			shardInboxes[i].slots[slot].sequence = slot;
+		}
+		shardInboxes[i].head = 0;
+		shardInboxes[i].tail = 0;
+	}
+	for(i = 0; i < shardCount; i++){
+		int capacity = taskCount/shardCount + 1;
+
+		shards[i].tasks = malloc(sizeof(Task*)*capacity);
+		shards[i].waiting = calloc(capacity, 1);
+		shards[i].issued = malloc(sizeof(long long)*capacity);
+		if(shards[i].tasks == NULL || shards[i].waiting == NULL || shards[i].issued == NULL){
+			fprintf(stderr, "Out of memory while starting the shards\n");
+			exit(1);
+		}
+	}
+
+	for(i = 0; i < taskCount; i++){		//deal the tasks out to the shards evenly
+		if(tasks[i].next < tasks[i].numOfTrans){
+			Shard *shard = &shards[i % shardCount];
+			shard->tasks[shard->taskCount++] = &tasks[i];
+			shardTasksLeft++;
+		}
+	}
+
+	for(i = 0; i < shardCount; i++){
+		if(pthread_create(&workers[i], NULL, &shardWorker, (void*)(intptr_t)i) != 0){
+			printf("\n Error creating thread %d", i);
+		}
+		pinThread(workers[i], i);
+	}
+	for(i = 0; i < shardCount; i++){
+		pthread_join(workers[i], NULL);
+	}
+
+	for(i = 0; i < shardCount; i++){
+		free(shards[i].tasks);
+		free(shards[i].waiting);
+		free(shards[i].issued);
+	}
+	free(shards);
+	free(shardInboxes);
+	free(workers);
+}
+
+#define VERIFY_REPORTED 10	//number of differing accounts the verifier lists before only counting them
+
+/*verifyBalances compares the final balance and type of every account with a golden output file, usually the output
+ * of a run of the deterministic batch engine on the same input, and reports the accounts that differ to stderr.
+ * Returns 0 if every account matches*/
+int verifyBalances(char *goldenname, int accountCount){
+
+	struct stat info;
+	int fd;
+	int differ = 0;
+	int listed = 0;		//number of accounts listed in the golden output
+	int i;
+
+	fd = open(goldenname, O_RDONLY);
+	if(fd < 0 || fstat(fd, &info) != 0){
+		printf("File %s could not be opened", goldenname);
+		return 1;
+	}
+	char *data = info.st_size > 0 ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if(data == MAP_FAILED){
+		printf("File %s could not be opened", goldenname);
+		return 1;
+	}
+
+	char *seen = calloc(accountCount + 1, 1);	//1 for every account listed in the golden output
+	const char *p = data;
+	const char *end = data + info.st_size;
+
+	/*every line is "a<num> type <personal|business> <balance>"*/
+	while(p < end){
+		p = skipSpaces(p, end);
+		if(p < end && *p == 'a'){
+			int accountNum = parseNumber(&p, end);
+			p = skipWord(skipSpaces(p, end), end);		//skip "type"
+			int type = p < end && *p == 'b' ? ACCOUNT_BUSINESS : ACCOUNT_PERSONAL;
+			p = skipWord(p, end);
+			int balance = parseNumber(&p, end);
+
+			listed++;
+			if(accountNum < 1 || accountNum > accountCount || seen[accountNum]){
+				if(differ++ < VERIFY_REPORTED){
+					fprintf(stderr, "a%d is listed in %s but not in this run\n", accountNum, goldenname);
+				}
+			}
+			else{
+				seen[accountNum] = 1;
+				if(type != accountConfig.type[accountNum - 1] || balance != accounts[accountNum - 1].balance){
+					if(differ++ < VERIFY_REPORTED){
+						fprintf(stderr, "a%d expected %s %d, got %s %d\n", accountNum, accountTypeNames[type], balance,
+							accountTypeNames[accountConfig.type[accountNum - 1]], accounts[accountNum - 1].balance);
+					}
+				}
+			}
+		}
+		while(p < end && *p != '\n'){				//move onto the next line
+			p++;
+		}
+		p++;
+	}
+
+	for(i = 1; i <= accountCount; i++){
+		if(!seen[i] && differ++ < VERIFY_REPORTED){
+			fprintf(stderr, "a%d is missing from %s\n", i, goldenname);
+		}
+	}
+	fprintf(stderr, "verified %d accounts against %d in %s: %d differ\n", accountCount, listed, goldenname, differ);
+
+	free(seen);
+	if(data != NULL){
+		munmap(data, info.st_size);
+	}
+	return differ > 0;
+}
+
+#define DEPOSIT_LANES 8		//accounts the deposit kernel works on at once, one per 32-bit lane of an AVX2 register
+
+//deposits of one depositor aggregated per account, kept as a structure of arrays for the kernel
+typedef struct depositGroups{
+	int *accountNum;	//account the deposits go to
+	unsigned int *sum;	//sum of the deposit amounts, wrapping the same way the balance does
+	int *count;		//number of deposits
+	unsigned int *delta;	//change of balance once the fees are taken, filled in by the kernel
+	int *first;		//position in the depositor's sorted deposits of the account's first deposit
+	int *balance;		//balance the deposits left, filled in while journaling
+	unsigned int *version;	//journal version of the change, filled in while journaling
+} DepositGroups;
+
+/*depositDeltasScalar is the portable deposit kernel. k deposits that are all processed add their sum less k
+ * deposit fees, and the additional fee for each one whose count goes over the transaction limit: with n
+ * transactions already made and a limit L that is the last n + k - L of them, clamped to between 0 and k*/
+static void depositDeltasScalar(DepositGroups *groups, int first, int last){
+
+	int i;
+
+	for(i = first; i < last; i++){
+		int index = groups->accountNum[i] - 1;
+		int count = groups->count[i];
+		int due = accounts[index].numberOfAccTrans + count - accountConfig.transactionNum[index];
+
+		due = due < 0 ? 0 : (due > count ? count : due);
+		groups->delta[i] = groups->sum[i] - (unsigned int)count*accountConfig.depositFee[index] - (unsigned int)due*accountConfig.additionalFee[index];
+	}
+}
+
+/*depositDeltasAvx2 is depositDeltasScalar for DEPOSIT_LANES accounts at a time, gathering the fee configuration
+ * from its arrays and the transaction counts from the cache line of each account*/
+__attribute__((target("avx2")))
+static void depositDeltasAvx2(DepositGroups *groups, int first, int last){
+
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i accountInts = _mm256_set1_epi32(sizeof(Acc)/sizeof(int));
+	int i;
+
+	for(i = first; i + DEPOSIT_LANES <= last; i += DEPOSIT_LANES){
+		__m256i index = _mm256_sub_epi32(_mm256_loadu_si256((__m256i*)&groups->accountNum[i]), one);
+		__m256i count = _mm256_loadu_si256((__m256i*)&groups->count[i]);
+		__m256i sum = _mm256_loadu_si256((__m256i*)&groups->sum[i]);
+
+		__m256i fee = _mm256_i32gather_epi32(accountConfig.depositFee, index, 4);
+		__m256i additionalFee = _mm256_i32gather_epi32(accountConfig.additionalFee, index, 4);
+		__m256i limit = _mm256_i32gather_epi32(accountConfig.transactionNum, index, 4);
+		__m256i made = _mm256_i32gather_epi32(&accounts[0].numberOfAccTrans, _mm256_mullo_epi32(index, accountInts), 4);
+
+		__m256i due = _mm256_sub_epi32(_mm256_add_epi32(made, count), limit);
+		due = _mm256_min_epi32(_mm256_max_epi32(due, zero), count);
+
+		__m256i delta = _mm256_sub_epi32(sum, _mm256_mullo_epi32(count, fee));
+		delta = _mm256_sub_epi32(delta, _mm256_mullo_epi32(due, additionalFee));
+		_mm256_storeu_si256((__m256i*)&groups->delta[i], delta);
+	}
+	depositDeltasScalar(groups, i, last);		//accounts left over after the last full register
+}
+
+/*applyDepositGroupAtomic applies the aggregated deposits of one account with compare and swap on its balance word.
+ * With lock-free deposits on, other depositors change accounts without overdraft without taking their lock, so the
+ * change is worked out again from the transaction count of every word it tries to replace*/
+static void applyDepositGroupAtomic(DepositGroups *groups, int group){
+
+	int index = groups->accountNum[group] - 1;
+	int count = groups->count[group];
+	Acc *account = &accounts[index];
+	AccBalance oldState;
+	AccBalance newState;
+
+	oldState.balanceWord = __atomic_load_n(&account->balanceWord, __ATOMIC_ACQUIRE);
+	do{
+		if(journaling){
+			groups->version[group] = claimJournalVersion(account);
+		}
+		int due = oldState.numberOfAccTrans + count - accountConfig.transactionNum[index];
+		due = due < 0 ? 0 : (due > count ? count : due);
+		newState.balance = (unsigned int)oldState.balance + groups->sum[group] - (unsigned int)count*accountConfig.depositFee[index] -
+			(unsigned int)due*accountConfig.additionalFee[index];
+		newState.numberOfAccTrans = oldState.numberOfAccTrans + count;
+	}while(!__atomic_compare_exchange_n(&account->balanceWord, &oldState.balanceWord, newState.balanceWord, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	groups->balance[group] = newState.balance;
+}
+
+/*applyDepositBlock applies the aggregated deposits of the accounts first to last, which are in ascending order,
+ * holding all of their accounts at once so the kernel sees the transaction counts it is adding to*/
+static void applyDepositBlock(DepositGroups *groups, int first, int last){
+
+	static int useAvx2 = -1;	//1 if the processor has AVX2, checked the first time through
+	int i;
+
+	if(useAvx2 < 0){
+		useAvx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+
+	if(lockMode == LOCK_GLOBAL){				//the global lock covers every account of the block
+		lockAccounts(groups->accountNum[first], groups->accountNum[first]);
+		for(i = first + 1; i < last && queryReaders; i++){
+			beginAccountWrite(groups->accountNum[i], groups->accountNum[i]);
+		}
+	}
+	else{
+		for(i = first; i < last; i++){			//ascending order, the same as every other critical region
+			lockAccounts(groups->accountNum[i], groups->accountNum[i]);
+		}
+	}
+
+	if(useAvx2){
+		depositDeltasAvx2(groups, first, last);
+	}
+	else{
+		depositDeltasScalar(groups, first, last);
+	}
+	for(i = first; i < last; i++){
+		Acc *account = &accounts[groups->accountNum[i] - 1];
+		account->balance = (unsigned int)account->balance + groups->delta[i];
+		account->numberOfAccTrans += groups->count[i];
+		if(journaling){
+			groups->version[i] = ++account->journalVersion;
+			groups->balance[i] = account->balance;
+		}
+	}
+
+	if(lockMode == LOCK_GLOBAL){
+		for(i = first + 1; i < last && queryReaders; i++){
+			endAccountWrite(groups->accountNum[i], groups->accountNum[i]);
+		}
+		unlockAccounts(groups->accountNum[first], groups->accountNum[first]);
+	}
+	else{
+		for(i = first; i < last; i++){
+			unlockAccounts(groups->accountNum[i], groups->accountNum[i]);
+		}
+	}
+}
+
+/*runDepositBatch processes a sequence of deposits from one depositor. Without the deposit kernel they run one at a
+ * time through runDeposit. With it they are sorted by account and aggregated, and each account whose deposits can
+ * all be processed gets them in one step computed by the kernel: the account has no overdraft and every amount
+ * covers the deposit fee and the additional fee, so the balance never goes negative and no deposit is rejected. The
+ * other accounts get their deposits one at a time in line order. Deposits on different accounts are independent, so
+ * the balances are the same as running every deposit through deposit() in line order. With lock-free deposits on,
+ * the aggregated accounts are applied with compare and swap instead of under their locks. While journaling, every
+ * aggregated deposit gets a record and the last one of each account holds the balance they all left*/
+void runDepositBatch(Trans *transactions, int count){
+
+	int i;
+
+	if(!depositKernel || localCounters || count < 2){	//the kernel keeps exact counts
+		for(i = 0; i < count; i++){
+			runDeposit(&transactions[i]);
+		}
+		return;
+	}
+
+	long long start = benchmark ? nowNanoseconds() : 0;
+	int highest = 0;
+	DepositGroups groups;
+	int groupCount = 0;
+
+	for(i = 0; i < count; i++){
+		if(transactions[i].giveAccountNum > highest){
+			highest = transactions[i].giveAccountNum;
+		}
+	}
+
+	int *position = calloc(highest + 2, sizeof(int));	//where the deposits of each account start in order
+	int *order = malloc(sizeof(int)*count);		//deposits sorted by account, in line order within an account
+	groups.accountNum = malloc(sizeof(int)*count);
+	groups.sum = malloc(sizeof(unsigned int)*count);
+	groups.count = malloc(sizeof(int)*count);
+	groups.delta = malloc(sizeof(unsigned int)*count);
+	groups.first = malloc(sizeof(int)*count);
+	groups.balance = malloc(sizeof(int)*count);
+	groups.version = malloc(sizeof(unsigned int)*count);
+	if(position == NULL || order == NULL || groups.accountNum == NULL || groups.sum == NULL || groups.count == NULL || groups.delta == NULL
+		|| groups.first == NULL || groups.balance == NULL || groups.version == NULL){
+		fprintf(stderr, "Out of memory while running deposits\n");
+		exit(1);
+	}
+
+	/*counting sort on the account number, which keeps the line order of the deposits on each account*/
+	for(i = 0; i < count; i++){
+		position[transactions[i].giveAccountNum + 1]++;
+	}
+	for(i = 1; i <= highest; i++){
+		position[i + 1] += position[i];
+	}
+	for(i = 0; i < count; i++){
+		order[position[transactions[i].giveAccountNum]++] = i;
+	}
+
+	/*aggregate the deposits of each account, running the accounts the kernel cannot take straight away*/
+	for(i = 0; i < count;){
+		int accountNum = transactions[order[i]].giveAccountNum;
+		int first = i;
+		int smallest = transactions[order[i]].amount;
+		unsigned int sum = 0;
+
+		for(; i < count && transactions[order[i]].giveAccountNum == accountNum; i++){
+			Trans *transaction = &transactions[order[i]];
+			sum += (unsigned int)transaction->amount;
+			if(transaction->amount < smallest){
+				smallest = transaction->amount;
+			}
+		}
+
+		int additionalFee = accountConfig.additionalFee[accountNum - 1] > 0 ? accountConfig.additionalFee[accountNum - 1] : 0;
+		if(accountConfig.overdraft[accountNum - 1] == 0 && (long long)smallest >= (long long)accountConfig.depositFee[accountNum - 1] + additionalFee){
+			groups.accountNum[groupCount] = accountNum;
+			groups.first[groupCount] = first;
+			groups.sum[groupCount] = sum;
+			groups.count[groupCount++] = i - first;
+		}
+		else{
+			int j;
+			for(j = first; j < i; j++){
+				runDeposit(&transactions[order[j]]);
+			}
+		}
+	}
+
+	if(atomicDeposits){			//the accounts can change under their locks, so each one is swapped in on its own
+		for(i = 0; i < groupCount; i++){
+			applyDepositGroupAtomic(&groups, i);
+		}
+	}
+	else{
+		for(i = 0; i < groupCount; i += DEPOSIT_LANES){
+			applyDepositBlock(&groups, i, i + DEPOSIT_LANES < groupCount ? i + DEPOSIT_LANES : groupCount);
+		}
+	}
+
+	for(i = 0; i < groupCount && journaling; i++){
+		int last = groups.first[i] + groups.count[i] - 1;
+		int j;
+		for(j = groups.first[i]; j < last; j++){
+			journalOutcome(&transactions[order[j]], TRANS_OK, 0, 0, 0, 0);
+		}
+		journalOutcome(&transactions[order[last]], TRANS_OK, 0, 0, groups.balance[i], groups.version[i]);
+	}
+
+	if(benchmark){				//every deposit of the batch waited for the whole batch
+		for(i = 0; i < count; i++){
+			recordLatency(start);
+		}
+	}
+
+	free(position);
+	free(order);
+	free(groups.accountNum);
+	free(groups.sum);
+	free(groups.count);
+	free(groups.delta);
+	free(groups.first);
+	free(groups.balance);
+	free(groups.version);
+}
+
+#define STREAM_READ (1 << 20)		//bytes read from the feed at a time
+#define STREAM_CHUNK 4096		//transactions in each buffer handed to a stream worker
+#define STREAM_WORD 32			//longest word of the feed kept, longer words are cut short
+#define CHECKPOINT_MAGIC "BANKCKP"	//magic at the start of a checkpoint, followed by a zero byte
+#define CHECKPOINT_VERSION 1		//version of the checkpoint layout
+
+//header at the start of a checkpoint, followed by one CheckpointAccount per account
+typedef struct checkpointHeader{
+	char magic[8];			//CHECKPOINT_MAGIC
+	uint32_t version;		//CHECKPOINT_VERSION of the program that wrote the checkpoint
+	uint32_t accountCount;		//number of accounts
+	uint64_t feedLines;		//lines of the feed whose transactions the balances hold
+	uint64_t feedTransactions;	//transactions on those lines
+} CheckpointHeader;
+
+//state of one account in a checkpoint
+typedef struct checkpointAccount{
+	int32_t balance;
+	int32_t numberOfAccTrans;
+	int32_t feeFreeTickets;
+	int32_t reserved;
+} CheckpointAccount;
+
+//buffer of feed transactions from one line, reused once a worker has run it
+typedef struct streamChunk{
+	Trans transactions[STREAM_CHUNK];
+	int count;			//number of transactions in the buffer
+	uint64_t line;			//feed line the transactions are from
+	struct streamChunk *next;	//next buffer in the queue or in the free list
+} StreamChunk;
+
+//the feed being read and the buffers shared between the reader and the stream workers
+typedef struct stream{
+	int fd;				//feed being read
+	char *buffer;			//bytes read from the feed and not yet tokenized
+	size_t start;			//first byte of the buffer not yet tokenized
+	size_t length;			//number of bytes in the buffer
+	int eof;			//1 once the feed has ended
+	pthread_mutex_t streamLock;	//protects everything below
+	pthread_cond_t workReady;	//signalled when a buffer is queued or the feed ends
+	pthread_cond_t workDone;	//signalled when a worker finishes a buffer
+	StreamChunk *queueHead;		//buffers waiting for a worker
+	StreamChunk *queueTail;
+	StreamChunk *freeChunks;	//buffers the reader can fill
+	int inFlight;			//buffers queued or being run
+	uint64_t currentLine;		//line the reader is on
+	int lineInFlight;		//buffers of the current line queued or being run, at most one so the line runs in order
+	int finished;			//1 once the reader has queued its last buffer
+} Stream;
+
+Stream stream;
+
+/*readStreamWord copies the next word on the current line of the feed into word. Returns its length, 0 at the end of
+ * the line (which is consumed) or -1 at the end of the feed. The read buffer is refilled as needed, so lines of any
+ * length are read in the same memory*/
+static int readStreamWord(char *word){
+
+	int length = 0;
+
+	for(;;){
+		if(stream.start == stream.length){
+			if(stream.eof){
+				return length > 0 ? length : -1;
+			}
+			ssize_t got = read(stream.fd, stream.buffer, STREAM_READ);
+			if(got < 0 && errno == EINTR){
+				continue;
+			}
+			if(got <= 0){
+				stream.eof = 1;
+				continue;
+			}
+			stream.start = 0;
+			stream.length = got;
+		}
+
+		char c = stream.buffer[stream.start];
+		if(c == ' ' || c == '\t' || c == '\r' || c == '\n'){
+			if(length > 0){			//the word ends here, a newline is left for the next call
+				word[length < STREAM_WORD ? length : STREAM_WORD - 1] = '\0';
+				return length;
+			}
+			stream.start++;
+			if(c == '\n'){
+				return 0;
+			}
+		}
+		else{
+			if(length < STREAM_WORD - 1){
+				word[length] = c;
+			}
+			length++;
+			stream.start++;
+		}
+	}
+}
+
+/*skipStreamLine moves the feed past the rest of the current line, returning 0 at the end of the feed*/
+static int skipStreamLine(void){
+
+	char word[STREAM_WORD];
+	int length;
+
+	while((length = readStreamWord(word)) > 0){
+	}
+	return length == 0;
+}
+
+/*streamNumber reads a number from a word of the feed, skipping a leading 'a' on account references*/
+static int streamNumber(const char *word, int length){
+	const char *cursor = word;
+	return parseNumber(&cursor, word + (length < STREAM_WORD ? length : STREAM_WORD - 1));
+}
+
+/*streamWorker runs buffers of feed transactions until the feed ends and the queue is empty*/
+void *streamWorker(void *arg){
+
+	(void)arg;
+
+	for(;;){
+		pthread_mutex_lock(&stream.streamLock);
+		while(stream.queueHead == NULL && !stream.finished){
+			pthread_cond_wait(&stream.workReady, &stream.streamLock);
+		}
+		StreamChunk *chunk = stream.queueHead;
+		if(chunk == NULL){
+			pthread_mutex_unlock(&stream.streamLock);
+			return NULL;
+		}
+		stream.queueHead = chunk->next;
+		if(stream.queueHead == NULL){
+			stream.queueTail = NULL;
+		}
+		pthread_mutex_unlock(&stream.streamLock);
+
+		int i;
+		for(i = 0; i < chunk->count; i++){
+			runClientTransaction(&chunk->transactions[i]);
+		}
+		flushLocalCounters();
+
+		pthread_mutex_lock(&stream.streamLock);
+		stream.inFlight--;
+		if(chunk->line == stream.currentLine){
+			stream.lineInFlight--;
+		}
+		chunk->next = stream.freeChunks;
+		stream.freeChunks = chunk;
+		pthread_cond_broadcast(&stream.workDone);
+		pthread_mutex_unlock(&stream.streamLock);
+	}
+}
+
+/*takeStreamChunk returns an empty buffer for the reader, waiting for a worker to give one back if none are free*/
+static StreamChunk *takeStreamChunk(void){
+
+	pthread_mutex_lock(&stream.streamLock);
+	while(stream.freeChunks == NULL){
+		pthread_cond_wait(&stream.workDone, &stream.streamLock);
+	}
+	StreamChunk *chunk = stream.freeChunks;
+	stream.freeChunks = chunk->next;
+	pthread_mutex_unlock(&stream.streamLock);
+
+	chunk->count = 0;
+	return chunk;
+}
+
+/*queueStreamChunk hands a filled buffer to the workers. A line's buffers are queued one at a time, each once the one
+ * before it has run, so the transactions of a line keep their order just as a client's do*/
+static void queueStreamChunk(StreamChunk *chunk){
+
+	pthread_mutex_lock(&stream.streamLock);
+	while(stream.lineInFlight > 0){
+		pthread_cond_wait(&stream.workDone, &stream.streamLock);
+	}
+	chunk->line = stream.currentLine;
+	chunk->next = NULL;
+	if(stream.queueTail != NULL){
+		stream.queueTail->next = chunk;
+	}
+	else{
+		stream.queueHead = chunk;
+	}
+	stream.queueTail = chunk;
+	stream.inFlight++;
+	stream.lineInFlight++;
+	pthread_cond_signal(&stream.workReady);
+	pthread_mutex_unlock(&stream.streamLock);
+}
+
+/*writeCheckpoint waits for the workers to run every queued buffer and writes the accounts to the checkpoint. The
+ * checkpoint is written to a temporary file that replaces the old one only once it is on disk, so a crash always
+ * leaves a whole checkpoint behind. Returns 0 on success*/
+static int writeCheckpoint(char *checkpointname, int accountCount, uint64_t feedLines, uint64_t feedTransactions){
+
+	CheckpointHeader header;
+	char tempname[4096];
+	int i;
+
+	pthread_mutex_lock(&stream.streamLock);
+	while(stream.inFlight > 0){
+		pthread_cond_wait(&stream.workDone, &stream.streamLock);
+	}
+	pthread_mutex_unlock(&stream.streamLock);
+
+	CheckpointAccount *records = calloc(accountCount > 0 ? accountCount : 1, sizeof(CheckpointAccount));
+	if(records == NULL){
+		fprintf(stderr, "Out of memory while writing checkpoint %s\n", checkpointname);
+		return 1;
+	}
+	for(i = 0; i < accountCount; i++){
+		records[i].balance = accounts[i].balance;
+		records[i].numberOfAccTrans = accounts[i].numberOfAccTrans;
+		records[i].feeFreeTickets = accounts[i].feeFreeTickets;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	header.version = CHECKPOINT_VERSION;
+	header.accountCount = accountCount;
+	header.feedLines = feedLines;
+	header.feedTransactions = feedTransactions;
+
+	snprintf(tempname, sizeof(tempname), "%s.tmp", checkpointname);
+	int fd = open(tempname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int failed = fd < 0 || writeAll(fd, (char*)&header, sizeof(header)) != 0 ||
+		writeAll(fd, (char*)records, sizeof(CheckpointAccount)*accountCount) != 0 || fdatasync(fd) != 0;
+	if(fd >= 0 && close(fd) != 0){
+		failed = 1;
+	}
+	if(!failed && rename(tempname, checkpointname) != 0){
+		failed = 1;
+	}
+	if(failed){
+		fprintf(stderr, "Checkpoint %s could not be written\n", checkpointname);
+	}
+
+	free(records);
+	return failed;
+}
+
+/*loadCheckpoint restores the accounts from a checkpoint of a run on the same input and returns the number of feed
+ * lines it holds in feedLines and the transactions on them in feedTransactions. Returns 0 on success*/
+int loadCheckpoint(char *checkpointname, int accountCount, uint64_t *feedLines, uint64_t *feedTransactions){
+
+	CheckpointHeader header;
+	int i;
+
+	FILE *checkpoint_fp = fopen(checkpointname, "rb");
+	if(checkpoint_fp == NULL){
+		printf("File %s could not be opened", checkpointname);
+		return 1;
+	}
+
+	if(fread(&header, sizeof(header), 1, checkpoint_fp) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 ||
+		header.version != CHECKPOINT_VERSION || header.accountCount != (uint32_t)accountCount){
+		fprintf(stderr, "Checkpoint %s does not match the input\n", checkpointname);
+		fclose(checkpoint_fp);
+		return 1;
+	}
+
+	for(i = 0; i < accountCount; i++){
+		CheckpointAccount record;
+		if(fread(&record, sizeof(record), 1, checkpoint_fp) != 1){
+			fprintf(stderr, "Checkpoint %s is truncated\n", checkpointname);
+			fclose(checkpoint_fp);
+			return 1;
+		}
+		accounts[i].balance = record.balance;
+		accounts[i].numberOfAccTrans = record.numberOfAccTrans;
+		accounts[i].feeFreeTickets = record.feeFreeTickets;
+	}
+	fclose(checkpoint_fp);
+
+	*feedLines = header.feedLines;
+	*feedTransactions = header.feedTransactions;
+	fprintf(stderr, "resumed from %s after %llu feed lines and %llu transactions\n", checkpointname,
+		(unsigned long long)header.feedLines, (unsigned long long)header.feedTransactions);
+	return 0;
+}
+
+/*runStream reads client lines from the feed until it ends and runs them on a pool of stream workers, with lines
+ * running concurrently the way clients do. The feed is read through one fixed buffer into a fixed set of transaction
+ * buffers, so memory stays the same however long it runs. A checkpoint already holds resumeLines lines with
+ * resumeTransactions transactions on them. A feed that is a regular file is read from its start again, so those
+ * lines are skipped; a pipe or FIFO only carries lines written after the restart, so nothing of it is skipped. With
+ * a checkpoint file, the accounts are written to it at the first line boundary after every checkpointEvery
+ * transactions and when the feed ends. Returns 0 on success*/
+int runStream(char *streamname, char *checkpointname, int accountCount, uint64_t resumeLines, uint64_t resumeTransactions){
+
+	int workers = poolSize();
+	int chunkCount = 4*workers;		//enough for every worker to have one buffer running and more queued
+	pthread_t *workerThreads = malloc(sizeof(pthread_t)*workers);
+	StreamChunk *chunks = malloc(sizeof(StreamChunk)*chunkCount);
+	char word[STREAM_WORD];
+	uint64_t feedLines = 0;			//lines of the feed read so far
+	uint64_t feedTransactions = resumeTransactions;	//transactions queued so far
+	uint64_t lastCheckpoint = resumeTransactions;	//feedTransactions at the last checkpoint
+	int checkpoints = 0;
+	int failed = 0;
+	int lineEnded;				//1 if the line just read ended in a newline, 0 if the feed ended with it
+	int length;
+	int i;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.fd = strcmp(streamname, "-") == 0 ? 0 : open(streamname, O_RDONLY);	//opening a FIFO waits for its writer
+	stream.buffer = malloc(STREAM_READ);
+	if(stream.fd < 0 || workerThreads == NULL || chunks == NULL || stream.buffer == NULL){
+		printf("File %s could not be opened", streamname);
+		return 1;
+	}
+	pthread_mutex_init(&stream.streamLock, NULL);
+	pthread_cond_init(&stream.workReady, NULL);
+	pthread_cond_init(&stream.workDone, NULL);
+	for(i = 0; i < chunkCount; i++){
+		chunks[i].next = stream.freeChunks;
+		stream.freeChunks = &chunks[i];
+	}
+
+	struct stat info;
+	if(fstat(stream.fd, &info) == 0 && S_ISREG(info.st_mode)){
+		for(; feedLines < resumeLines && skipStreamLine(); feedLines++){	//already held by the checkpoint
+		}
+	}
+	else{
+		feedLines = resumeLines;		//the feed carries on after the lines the checkpoint holds
+	}
+
+	for(i = 0; i < workers; i++){
+		if(pthread_create(&workerThreads[i], NULL, &streamWorker, NULL) != 0){
+			printf("\n Error creating thread %d", i);
+		}
+		pinThread(workerThreads[i], i);
+	}
+
+	/*read the feed a line at a time, queueing a buffer whenever one fills up and at the end of every line*/
+	while((length = readStreamWord(word)) >= 0){
+		lineEnded = 1;
+
+		if(length > 0 && word[0] != 'c' && !(word[0] == 'd' && word[1] == 'e')){	//accounts cannot be added to a running bank
+			lineEnded = skipStreamLine();
+		}
+		else if(length > 0){				//depositor or client line
+			StreamChunk *chunk = takeStreamChunk();
+			Trans obj;
+
+			while((length = readStreamWord(word)) > 0){
+				obj.transType = word[0];
+				obj.takeAccountNum = 0;
+				obj.giveAccountNum = 0;
+				if(length != 1 || (obj.transType != 'd' && obj.transType != 'w' && obj.transType != 't')){
+					continue;				//not a transaction, move onto the next word
+				}
+
+				if((length = readStreamWord(word)) <= 0){
+					break;
+				}
+				if(obj.transType == 'd'){			//deposit: d a<account> <amount>
+					obj.giveAccountNum = streamNumber(word, length);
+				}
+				else{						//withdraw: w a<account> <amount>, transfer: t a<from> a<to> <amount>
+					obj.takeAccountNum = streamNumber(word, length);
+				}
+				if(obj.transType == 't'){
+					if((length = readStreamWord(word)) <= 0){
+						break;
+					}
+					obj.giveAccountNum = streamNumber(word, length);
+				}
+				if((length = readStreamWord(word)) <= 0){
+					break;
+				}
+				obj.amount = streamNumber(word, length);
+
+				chunk->transactions[chunk->count++] = obj;
+				if(chunk->count == STREAM_CHUNK){		//the line carries on in a new buffer
+					feedTransactions += chunk->count;
+					queueStreamChunk(chunk);
+					chunk = takeStreamChunk();
+				}
+			}
+			lineEnded = length == 0;
+
+			if(chunk->count > 0){
+				feedTransactions += chunk->count;
+				queueStreamChunk(chunk);
+			}
+			else{						//give back the unused buffer
+				pthread_mutex_lock(&stream.streamLock);
+				chunk->next = stream.freeChunks;
+				stream.freeChunks = chunk;
+				pthread_mutex_unlock(&stream.streamLock);
+			}
+		}
+
+		feedLines++;
+		pthread_mutex_lock(&stream.streamLock);		//the next line starts with none of its buffers queued
+		stream.currentLine++;
+		stream.lineInFlight = 0;
+		pthread_mutex_unlock(&stream.streamLock);
+
+		if(checkpointname != NULL && feedTransactions - lastCheckpoint >= (uint64_t)checkpointEvery){
+			failed |= writeCheckpoint(checkpointname, accountCount, feedLines, feedTransactions);
+			lastCheckpoint = feedTransactions;
+			checkpoints++;
+		}
+		if(!lineEnded){
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&stream.streamLock);
+	stream.finished = 1;
+	pthread_cond_broadcast(&stream.workReady);
+	pthread_mutex_unlock(&stream.streamLock);
+	for(i = 0; i < workers; i++){
+		pthread_join(workerThreads[i], NULL);
+	}
+
+	if(checkpointname != NULL){		//the end of the feed is checkpointed too, so a restart runs only new lines
+		failed |= writeCheckpoint(checkpointname, accountCount, feedLines > resumeLines ? feedLines : resumeLines, feedTransactions);
+		checkpoints++;
+	}
+	fprintf(stderr, "stream lines %llu transactions %llu checkpoints %d\n", (unsigned long long)(feedLines - (feedLines < resumeLines ? feedLines : resumeLines)),
+		(unsigned long long)(feedTransactions - resumeTransactions), checkpoints);
 
-	if (initialBalance == accounts[giveAccountNum - 1].balance){	//if receiving account is unable to process the depost transaction then refund the original sender
-		accounts[takeAccountNum - 1].balance += amount;
-		accounts[takeAccountNum - 1].balance += accounts[takeAccountNum - 1].transferFee;
-		accounts[takeAccountNum - 1].numberOfAccTrans--;
+	if(stream.fd != 0){
+		close(stream.fd);
 	}
+	pthread_mutex_destroy(&stream.streamLock);
+	pthread_cond_destroy(&stream.workReady);
+	pthread_cond_destroy(&stream.workDone);
+	free(stream.buffer);
+	free(chunks);
+	free(workerThreads);
+	return failed;
 }
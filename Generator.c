@@ -0,0 +1,180 @@
+/*Description: This file contains a synthetic workload generator for the banking system. It writes an input file in
+ the same format as assignment_3_input_file.txt (accounts, then depositors, then clients) with a configurable number
+ of accounts, depositors, clients and transactions, a deposit/withdraw/transfer mix and a Zipf skew towards hot accounts.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+//parameters of the generated workload
+typedef struct workload{
+	int accountCount;	//number of accounts
+	int depositorCount;	//number of depositors
+	int clientCount;	//number of clients
+	int transactionCount;	//number of transactions per depositor and per client
+	int depositPercent;	//percentage of client transactions that are deposits
+	int withdrawPercent;	//percentage of client transactions that are withdraws, the rest are transfers
+	double zipf;		//Zipf exponent for choosing accounts, 0 chooses them uniformly
+	unsigned int seed;	//seed for the random number generator
+} Workload;
+
+double *zipfTable;		//cumulative probability of choosing each account
+
+/*buildZipfTable fills the cumulative distribution used to choose accounts, where account k is chosen
+ * with a probability proportional to 1/k^zipf*/
+void buildZipfTable(Workload *workload){
+
+	int i;
+	double total = 0;
+
+	zipfTable = malloc(sizeof(double)*workload->accountCount);
+	for(i = 0; i < workload->accountCount; i++){
+		total += 1.0/pow(i + 1, workload->zipf);
+		zipfTable[i] = total;
+	}
+	for(i = 0; i < workload->accountCount; i++){
+		zipfTable[i] /= total;
+	}
+}
+
+/*chooseAccount picks an account number from the Zipf distribution with a binary search of the table*/
+int chooseAccount(Workload *workload){
+
+	double target = rand()/((double)RAND_MAX + 1);
+	int low = 0;
+	int high = workload->accountCount - 1;
+
+	while(low < high){
+		int middle = (low + high)/2;
+		if(zipfTable[middle] < target){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	return low + 1;
+}
+
+/*randomBetween returns a random integer in the range [low, high]*/
+int randomBetween(int low, int high){
+	return low + rand()%(high - low + 1);
+}
+
+/*writeWorkload writes the accounts, depositors and clients of the workload to the output file*/
+void writeWorkload(Workload *workload, FILE *output_fp){
+
+	int i;
+	int j;
+
+	/*accounts: a<num> type <business|personal> d <fee> w <fee> t <fee> transactions <limit> <fee> overdraft <Y fee|N>*/
+	for(i = 0; i < workload->accountCount; i++){
+		fprintf(output_fp, "a%d type %s d %d w %d t %d transactions %d %d overdraft ", i + 1, rand()%2 ? "business" : "personal",
+			randomBetween(0, 20), randomBetween(0, 20), randomBetween(0, 20), randomBetween(0, 20), randomBetween(0, 20));
+		if(rand()%2){
+			fprintf(output_fp, "Y %d\n", randomBetween(5, 50));
+		}
+		else{
+			fprintf(output_fp, "N\n");
+		}
+	}
+
+	/*depositors: dep<num> d a<account> <amount> ...*/
+	for(i = 0; i < workload->depositorCount; i++){
+		fprintf(output_fp, "dep%d", i + 1);
+		for(j = 0; j < workload->transactionCount; j++){
+			fprintf(output_fp, " d a%d %d", chooseAccount(workload), randomBetween(100, 5000));
+		}
+		fprintf(output_fp, "\n");
+	}
+
+	/*clients: c<num> followed by d a<account> <amount>, w a<account> <amount> or t a<from> a<to> <amount>*/
+	for(i = 0; i < workload->clientCount; i++){
+		fprintf(output_fp, "c%d", i + 1);
+		for(j = 0; j < workload->transactionCount; j++){
+			int kind = rand()%100;
+
+			if(kind < workload->depositPercent){
+				fprintf(output_fp, " d a%d %d", chooseAccount(workload), randomBetween(1, 1000));
+			}
+			else if(kind < workload->depositPercent + workload->withdrawPercent){
+				fprintf(output_fp, " w a%d %d", chooseAccount(workload), randomBetween(1, 1000));
+			}
+			else{
+				fprintf(output_fp, " t a%d a%d %d", chooseAccount(workload), chooseAccount(workload), randomBetween(1, 1000));
+			}
+		}
+		fprintf(output_fp, "\n");
+	}
+}
+
+/*printUsage lists the generator's options*/
+void printUsage(FILE *fp, char *program){
+	fprintf(fp, "usage: %s [-a accounts] [-d depositors] [-c clients] [-n transactions] "
+		"[-m deposit%%,withdraw%%] [-z zipf] [-s seed] [-o output] [-h]\n", program);
+}
+
+int main(int argc, char *argv[]){
+
+	Workload workload = {100, 4, 16, 1000, 40, 30, 0.0, 1};
+	char *filename = "assignment_3_input_file.txt";
+	int opt;
+
+	/*parse the command line options*/
+	while((opt = getopt(argc, argv, "a:d:c:n:m:z:s:o:h")) != -1){
+		if(opt == 'a'){
+			workload.accountCount = atoi(optarg);
+		}
+		else if(opt == 'd'){
+			workload.depositorCount = atoi(optarg);
+		}
+		else if(opt == 'c'){
+			workload.clientCount = atoi(optarg);
+		}
+		else if(opt == 'n'){
+			workload.transactionCount = atoi(optarg);
+		}
+		else if(opt == 'm' && sscanf(optarg, "%d,%d", &workload.depositPercent, &workload.withdrawPercent) == 2){
+			continue;
+		}
+		else if(opt == 'z'){
+			workload.zipf = atof(optarg);
+		}
+		else if(opt == 's'){
+			workload.seed = atoi(optarg);
+		}
+		else if(opt == 'o'){
+			filename = optarg;
+		}
+		else if(opt == 'h'){
+			printUsage(stdout, argv[0]);
+			return 0;
+		}
+		else{
+			printUsage(stderr, argv[0]);
+			return 1;
+		}
+	}
+
+	if(workload.accountCount < 1 || workload.depositPercent + workload.withdrawPercent > 100){
+		fprintf(stderr, "Invalid workload parameters\n");
+		return 1;
+	}
+
+	FILE *output_fp = fopen(filename, "w");
+	if(output_fp == NULL){
+		printf("File %s could not be opened", filename);
+		return 1;
+	}
+
+	srand(workload.seed);
+	buildZipfTable(&workload);
+	writeWorkload(&workload, output_fp);
+
+	fclose(output_fp);
+	free(zipfTable);
+	return 0;
+}
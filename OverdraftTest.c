@@ -0,0 +1,75 @@
+/*Description: This file contains a randomized differential test of overdraftCharge. It keeps the two while loops that
+ deposit and withdraw used to walk the overdraft tiers with as the reference, and checks that overdraftCharge rejects
+ the same transactions and leaves the same balances for random initial balances, new balances and overdraft fees.
+ **/
+
+#define main bankMain
+#include "BankingSystem.c"
+#undef main
+
+/*referenceOverdraft is the original overdraft loop of deposit and withdraw for tiers of 500 down to -5000. Returns 0 if
+ * the overdraft limit has been exceeded, otherwise stores the final balance in result and returns 1*/
+int referenceOverdraft(int tempInitialBalance, int tempBalance, int overdraftFee, int *result){
+
+	int j = -500;
+
+	while (tempInitialBalance < j){	//figure out what range the balance is in before the transaction is applied
+		j -= 500;
+	}
+
+	while (tempBalance < j){	//figure out the difference in value between the inital range and the new range of the balance
+		if(j == -5000){	//if j is -5000 then overdraft limit has been exceeded and do not process transaction(balance < -5000)
+			return 0;
+		}
+
+		tempBalance -= overdraftFee;	//each iteration of the loop apply overdraft fee
+		j -= 500;			//update value of j
+	}
+
+	if(tempInitialBalance > 0 && tempBalance < 0){	//this is the case for if the balance goes from a positive value to a negative one caused by the current transaction
+		tempBalance -= overdraftFee;
+	}
+
+	*result = tempBalance;
+	return 1;
+}
+
+int main(int argc, char *argv[]){
+
+	long cases = argc > 1 ? atol(argv[1]) : 2000000;	//number of random cases to check
+	long i;
+	long failures = 0;
+
+	srand(1);
+	for(i = 0; i < cases; i++){
+		int initialBalance = rand()%12000 - 8000;
+		int newBalance = initialBalance - rand()%7000 - 1;
+		int overdraftFee = rand()%700;
+		int expected = 0;
+		int actual = 0;
+
+		if(newBalance >= 0){		//deposit and withdraw only charge overdraft on a negative balance
+			continue;
+		}
+		if(overdraftFee >= 500 && initialBalance < -5000){	//the reference loop never ends on these
+			continue;
+		}
+
+		int expectedStatus = referenceOverdraft(initialBalance, newBalance, overdraftFee, &expected);
+		int actualStatus = overdraftCharge(initialBalance, newBalance, overdraftFee, &actual);
+
+		if(expectedStatus != actualStatus || (expectedStatus && expected != actual)){
+			if(failures++ < 10){
+				printf("initial %d new %d fee %d: expected %d %d, got %d %d\n", initialBalance, newBalance, overdraftFee,
+						expectedStatus, expected, actualStatus, actual);
+			}
+		}
+	}
+
+	if(failures > 0){
+		printf("FAIL overdraft charge: %ld of %ld cases differ\n", failures, cases);
+		return 1;
+	}
+	printf("PASS overdraft charge: %ld cases\n", cases);
+	return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Benchmark harness: generates a synthetic workload and runs BankingSystem.out over each engine and worker count,
+# reporting transactions/sec and the p50/p99 latency per transaction.
+# Workload parameters come from the environment, for example: ACCOUNTS=1000 CLIENTS=64 ZIPF=1.1 ./bench.sh
+# Setting READERS also measures the read throughput of balance queries running alongside the transactions.
+# Each lock primitive in PRIMITIVES is compared on the thread engine over the same worker counts.
+
+ACCOUNTS=${ACCOUNTS:-1000}
+DEPOSITORS=${DEPOSITORS:-8}
+CLIENTS=${CLIENTS:-64}
+TRANSACTIONS=${TRANSACTIONS:-10000}
+MIX=${MIX:-40,30}
+ZIPF=${ZIPF:-0.8}
+THREADS=${THREADS:-"1 2 4 8 16 32 64"}
+ENGINES=${ENGINES:-"steal batch shard"}
+PRIMITIVES=${PRIMITIVES:-"mutex spin mcs adaptive"}
+
+BIN=$(pwd)/BankingSystem.out
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+./Generator.out -a "$ACCOUNTS" -d "$DEPOSITORS" -c "$CLIENTS" -n "$TRANSACTIONS" -m "$MIX" -z "$ZIPF" \
+	-o "$DIR/assignment_3_input_file.txt" || exit 1
+
+echo "workload: $ACCOUNTS accounts, $DEPOSITORS depositors, $CLIENTS clients x $TRANSACTIONS transactions, mix $MIX, zipf $ZIPF"
+printf "%-8s %-10s %8s %14s %10s %10s\n" engine lock threads tps p50_ns p99_ns
+
+# run prints one result row from the "bench ..." line BankingSystem.out writes to stderr
+run(){
+	(cd "$DIR" && "$BIN" -b "$@" 2>&1 >/dev/null) | awk -v label="$LABEL" '
+		$1 == "bench" { printf "%s %14s %10s %10s\n", label, $7, $9, $11 }'
+}
+
+for lock in global account optimistic; do
+	LABEL=$(printf "%-8s %-10s %8s" thread $lock $CLIENTS)
+	run -e thread -l $lock
+done
+
+for engine in $ENGINES; do
+	for threads in $THREADS; do
+		for lock in global account optimistic; do
+			if [ "$engine" != steal ] && [ "$lock" != global ]; then
+				continue	# the batch and shard engines do not lock
+			fi
+			LABEL=$(printf "%-8s %-10s %8s" $engine $lock $threads)
+			run -e $engine -l $lock -w $threads
+		done
+	done
+done
+
+# the bank and account locks built on each primitive, with the thread engine capped at the worker count
+if [ -n "$PRIMITIVES" ]; then
+	echo
+	printf "%-8s %-10s %8s %14s %10s %10s\n" primitive lock threads tps p50_ns p99_ns
+	for primitive in $PRIMITIVES; do
+		for threads in $THREADS; do
+			for lock in global account; do
+				LABEL=$(printf "%-8s %-10s %8s" $primitive $lock $threads)
+				run -e thread -l $lock -w $threads -m $primitive
+			done
+		done
+	done
+fi
+
+# read throughput of the balance queries under write load, for example READERS="1 2 4 8" ./bench.sh
+if [ -n "$READERS" ]; then
+	echo
+	printf "%-8s %-10s %8s %14s %16s %10s %10s\n" engine lock readers tps reads_per_sec snapshots consistent
+	for readers in $READERS; do
+		(cd "$DIR" && "$BIN" -b -q -e steal -l account -Q "$readers" 2>&1 >/dev/null) | awk -v readers="$readers" '
+			$1 == "queries" { reads = $7; snapshots = $9; consistent = $11 }
+			$1 == "bench" { tps = $7 }
+			END { printf "%-8s %-10s %8s %14s %16s %10s %10s\n", "steal", "account", readers, tps, reads, snapshots, consistent }'
+	done
+fi
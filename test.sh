@@ -0,0 +1,153 @@
+#!/bin/sh
+# Test harness run by make test.
+# Deposit stress: many depositors deposit into the same few accounts. Deposits of amounts that cover every fee all
+# commute, so the lock-free deposits of -a must leave the same balances as the mutex protected ones.
+# Lock stress: many clients withdraw from, deposit into and transfer between the same few accounts, which hold enough
+# that nothing is rejected and charge the additional fee on every transaction, so the final balances do not depend on
+# the order the transactions run in and every lock primitive must leave the same balances as the mutex.
+# Verifier: every engine and mode must match the golden output of the deterministic batch engine on a generated input.
+
+DEPOSITORS=${DEPOSITORS:-200}
+TRANSACTIONS=${TRANSACTIONS:-200}
+
+BIN=$(pwd)/BankingSystem.out
+GENERATOR=$(pwd)/Generator.out
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+status=0
+
+# accounts a1-a3 take the lock-free path, a4 has overdraft and always takes its lock
+awk -v depositors="$DEPOSITORS" -v transactions="$TRANSACTIONS" 'BEGIN {
+	print "a1 type business d 2 w 0 t 0 transactions 1000 3 overdraft N"
+	print "a2 type personal d 0 w 0 t 0 transactions 0 1 overdraft N"
+	print "a3 type business d 1 w 0 t 0 transactions 50000 0 overdraft N"
+	print "a4 type personal d 1 w 0 t 0 transactions 10 2 overdraft Y 30"
+	srand(1)
+	for(i = 1; i <= depositors; i++){
+		line = "dep" i
+		for(j = 0; j < transactions; j++){
+			line = line " d a" int(rand()*4) + 1 " " int(rand()*100) + 10
+		}
+		print line
+	}
+}' > "$DIR/deposits.txt"
+
+"$BIN" -q -i "$DIR/deposits.txt" -o "$DIR/mutex.txt" > /dev/null 2>&1 || status=1
+for args in "-a" "-a -l account" "-a -e steal -w 4" "-a -k -w 4" "-a -k -e steal -w 4"; do
+	"$BIN" -q $args -i "$DIR/deposits.txt" -o "$DIR/atomic.txt" > /dev/null 2>&1 || status=1
+	if cmp -s "$DIR/mutex.txt" "$DIR/atomic.txt"; then
+		echo "PASS deposit stress $args"
+	else
+		echo "FAIL deposit stress $args"
+		diff "$DIR/mutex.txt" "$DIR/atomic.txt" | head -5
+		status=1
+	fi
+done
+
+awk -v clients="$DEPOSITORS" -v transactions="$TRANSACTIONS" 'BEGIN {
+	print "a1 type business d 2 w 3 t 4 transactions 0 1 overdraft N"
+	print "a2 type personal d 1 w 2 t 3 transactions 0 2 overdraft N"
+	print "a3 type business d 3 w 1 t 2 transactions 0 1 overdraft N"
+	print "a4 type personal d 0 w 4 t 1 transactions 0 3 overdraft N"
+	print "dep1 d a1 10000000 d a2 10000000 d a3 10000000 d a4 10000000"
+	srand(2)
+	for(i = 1; i <= clients; i++){
+		line = "c" i
+		for(j = 0; j < transactions; j++){
+			take = int(rand()*4) + 1
+			give = (take + int(rand()*3)) % 4 + 1
+			kind = int(rand()*3)
+			if(kind == 0){
+				line = line " d a" give " " int(rand()*100) + 10
+			}
+			else if(kind == 1){
+				line = line " w a" take " " int(rand()*100) + 10
+			}
+			else{
+				line = line " t a" take " a" give " " int(rand()*100) + 10
+			}
+		}
+		print line
+	}
+}' > "$DIR/locks.txt"
+
+"$BIN" -q -l account -w 16 -i "$DIR/locks.txt" -o "$DIR/mutex.txt" > /dev/null 2>&1 || status=1
+for primitive in spin mcs adaptive; do
+	for workers in 16 64; do
+		args="-m $primitive -l account -w $workers"
+		"$BIN" -q $args -i "$DIR/locks.txt" -o "$DIR/locked.txt" > /dev/null 2>&1 || status=1
+		if cmp -s "$DIR/mutex.txt" "$DIR/locked.txt"; then
+			echo "PASS lock stress $args"
+		else
+			echo "FAIL lock stress $args"
+			diff "$DIR/mutex.txt" "$DIR/locked.txt" | head -5
+			status=1
+		fi
+	done
+done
+
+"$GENERATOR" -a 64 -d 16 -c 32 -n 400 -s 1 -o "$DIR/generated.txt" || status=1
+"$BIN" -q -C "$DIR/generated.img" -i "$DIR/generated.txt" > /dev/null 2>&1 || status=1
+"$BIN" -q -e batch -w 1 -i "$DIR/generated.txt" -o "$DIR/golden.txt" > /dev/null 2>&1 || status=1
+for args in "-e batch -w 4" "-e shard -w 1" "-e shard -w 4" "-e shard -w 7" "-l account" "-l optimistic" "-e pipeline" "-c" \
+	"-I $DIR/generated.img -k"; do
+	if "$BIN" -q -i "$DIR/generated.txt" $args -o "$DIR/verified.txt" -V "$DIR/golden.txt" > /dev/null 2> "$DIR/verify.txt"; then
+		echo "PASS verify $args"
+	else
+		echo "FAIL verify $args"
+		head -5 "$DIR/verify.txt"
+		status=1
+	fi
+done
+
+# Journal: a run's journal must replay to the run's balances. A journal that was never closed is replayed from the
+# input up to the records it holds, without reading its footer or a record cut in half as records.
+"$BIN" -q -l account -w 4 -i "$DIR/generated.txt" -o "$DIR/journaled.txt" -j "$DIR/run.jnl" > /dev/null 2>&1 || status=1
+"$BIN" -q -R "$DIR/run.jnl" -o "$DIR/replayed.txt" > /dev/null 2>&1 || status=1
+if cmp -s "$DIR/journaled.txt" "$DIR/replayed.txt"; then
+	echo "PASS journal replay"
+else
+	echo "FAIL journal replay"
+	status=1
+fi
+cp "$DIR/run.jnl" "$DIR/open.jnl"
+dd if=/dev/zero of="$DIR/open.jnl" bs=1 seek=32 count=8 conv=notrunc 2> /dev/null	# footerOffset
+"$BIN" -q -R "$DIR/open.jnl" -i "$DIR/generated.txt" -o "$DIR/replayed.txt" > /dev/null 2>&1 || status=1
+if cmp -s "$DIR/journaled.txt" "$DIR/replayed.txt"; then
+	echo "PASS journal replay unclosed"
+else
+	echo "FAIL journal replay unclosed"
+	status=1
+fi
+truncate -s $((64 + 32*1000 + 16)) "$DIR/open.jnl"		# 1000 records after the header, then half a record
+if "$BIN" -q -R "$DIR/open.jnl" -i "$DIR/generated.txt" -o "$DIR/replayed.txt" 2>&1 > /dev/null | grep -q "^replayed 1000 records"; then
+	echo "PASS journal replay torn"
+else
+	echo "FAIL journal replay torn"
+	status=1
+fi
+
+# Streaming: the client lines of the generated input fed through -S must leave the balances of the whole file. A run
+# that checkpoints part of the feed and is restarted on the whole feed must skip what the checkpoint holds and end the
+# same way.
+grep -v '^c' "$DIR/generated.txt" > "$DIR/base.txt"
+grep '^c' "$DIR/generated.txt" > "$DIR/feed.txt"
+head -n 10 "$DIR/feed.txt" > "$DIR/partial.txt"
+"$BIN" -q -i "$DIR/generated.txt" -o "$DIR/whole.txt" > /dev/null 2>&1 || status=1
+"$BIN" -q -i "$DIR/base.txt" -S "$DIR/feed.txt" -o "$DIR/streamed.txt" > /dev/null 2>&1 || status=1
+if cmp -s "$DIR/whole.txt" "$DIR/streamed.txt"; then
+	echo "PASS stream"
+else
+	echo "FAIL stream"
+	status=1
+fi
+"$BIN" -q -i "$DIR/base.txt" -S "$DIR/partial.txt" -K "$DIR/stream.ckpt" -E 1000 -o "$DIR/streamed.txt" > /dev/null 2>&1 || status=1
+"$BIN" -q -i "$DIR/base.txt" -S "$DIR/feed.txt" -K "$DIR/stream.ckpt" -E 1000 -o "$DIR/streamed.txt" > /dev/null 2>&1 || status=1
+if cmp -s "$DIR/whole.txt" "$DIR/streamed.txt"; then
+	echo "PASS stream resume"
+else
+	echo "FAIL stream resume"
+	status=1
+fi
+
+exit $status